@@ -8,8 +8,17 @@ OBJDIR=$(BUILDDIR)obj/
 INCDIR=$(PROJDIR)include/
 SRCDIR=$(PROJDIR)src/
 
+# --handlers: also generate a virtual handler_t per server interface
+# --shards N: split the generated sources into N translation units
+SCANNERFLAGS= --handlers --shards 8
+
 OPTS= -fpermissive -std=c++11 -fPIC -g -pthread #-fkeep-inline-functions
 
+# make SANITIZE=address builds everything instrumented, see tests/Makefile
+ifneq ($(SANITIZE),)
+OPTS+= -fsanitize=$(SANITIZE) -fno-omit-frame-pointer
+endif
+
 WESTON_PREFIX=/home/shawn/singularity-workspace/weston/install/
 
 INCLUDES= -I$(WESTON_PREFIX)include/ -I$(WESTON_PREFIX)include/libweston-2/ -I/usr/local/include/ -I/usr/include/pixman-1/ -I/usr/include/libdrm/ -I$(INCDIR)
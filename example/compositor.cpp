@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include <algorithm>
 #include <iostream>
 #include <queue>
 #include <vector>
@@ -38,6 +39,7 @@
 
 #include <wayland-util.hpp>
 #include <wayland-shm.hpp>
+#include <wayland-shm-convert.hpp>
 
 #include <wayland-server.hpp>
 
@@ -52,6 +54,7 @@
 
 #include "helper.hpp"
 #include "wrapper.hpp"
+#include "uploader.hpp"
 
 using namespace wayland;
 using namespace wayland::detail;
@@ -86,23 +89,34 @@ int example_surface::bind(surface_resource_t surf) {
 	};
 
 	surf.on_attach() = [&](wayland::buffer_resource_t buf_res, int x, int y) {
-		cout << "attach buffer(" << buf_res.get_id() << ") to: x(" << x << "), y(" << y << ")" << endl;
-		if (pending.buffer) {
-			pending.buffer->release();
+		if (buf_res) {
+			cout << "attach buffer(" << buf_res.get_id() << ") to: x(" << x << "), y(" << y << ")" << endl;
+		} else {
+			cout << "attach NULL buffer" << endl;
+		}
+		// replaced before it was committed, never going to be read
+		if (pending.buffer && !pending.buffer.is_destroyed()) {
+			pending.buffer.send_release();
 		}
 		shm_buffer_t *buffer = shm_buffer_t::from_resource(buf_res);
 		//pending.buffer.reset(buffer);
 		pending.newly_attached = true;
-		pending.buffer = buffer;
+		pending.buffer = buf_res;
 		pending.sx = x;
 		pending.sy = y;
-		width = buffer->get_width();
-		height = buffer->get_height();
+		if (buffer) {
+			width = buffer->get_width();
+			height = buffer->get_height();
+		} else {
+			width = 0;
+			height = 0;
+		}
 	};
 
 	surf.on_frame() = [&](callback_resource_t c) {
 		cout << "frame" << endl;
-		frame_queue.push(c);
+		// belongs to the state of the next commit
+		pending.frame_callbacks.push_back(c);
 	};
 
 	surf.on_damage() = [&](int x, int y, int width, int height) {
@@ -113,9 +127,15 @@ int example_surface::bind(surface_resource_t surf) {
 				x, y, width, height);
 	};
 
+	surf.on_damage_buffer() = [&](int x, int y, int width, int height) {
+		pixman_region32_union_rect(&pending.damage_buffer,
+				&pending.damage_buffer,
+				x, y, width, height);
+	};
+
 	surf.on_commit() = [&]() {
 		//cout << "commit" << endl;
-		//swap(pending, current);
+		commit_state();
 	};
 }
 
@@ -124,8 +144,8 @@ surface_resource_t &example_surface::get_resource() {
 }
 
 shm_buffer_t *example_surface::get_buffer() {
-	//return current.buffer.get();
-	return pending.buffer;
+	// only valid until the contents are uploaded, see draw()
+	return shm_buffer_t::from_resource(current.buffer);
 }
 
 std::vector<int> example_surface::to_window_space(std::vector<float> v)
@@ -136,26 +156,80 @@ std::vector<float> example_surface::to_screen_space(std::vector<int> v)
 {
 }
 
-void example_surface::frame_done() {
-	if (frame_queue.empty()) {
-		return;
+void example_surface::frame_done(uint32_t msecs) {
+	// done is a destructor event, gone clients are skipped by post_event
+	for (auto &c : current.frame_callbacks) {
+		c.send_done(msecs);
+		c.destroy();
 	}
-	timeval tv;
-	gettimeofday(&tv, 0);
-	uint32_t x = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	// keeps its capacity for the next frame
+	current.frame_callbacks.clear();
+}
+
+void example_surface::add_feedback(wp_presentation_feedback_resource_t feedback) {
+	pending.feedback.add(feedback);
+}
 
-	frame_queue.front().send_done(x);
-	frame_queue.pop();
+void example_surface::discard_feedback() {
+	current.feedback.discarded();
 }
 
 
 
 example_surface::example_surface(example_compositor *c)
-	: compositor(c), view(NULL)
+	: role(surface_role::none), compositor(c), view(NULL),
+	parent(NULL), sync(true),
+	sub_x(0), sub_y(0), pending_x(0), pending_y(0),
+	position_pending(false), has_cached(false), stack_dirty(false),
+	texture(0), tex_width(0), tex_height(0)
 {
 	shader = c->get_shader();
+	stack.push_back(this);
+	stack_pending.push_back(this);
+}
+bool example_surface::set_role(surface_role r) {
+	if (role != surface_role::none && role != r)
+		return false;
+	role = r;
+	return true;
+}
+
+example_surface *example_surface::get_root() {
+	example_surface *s = this;
+	while (s->parent)
+		s = s->parent;
+	return s;
+}
+
+example_surface *example_surface::pick(int32_t x, int32_t y) {
+	// the reverse of draw_tree(), topmost first; subsurface views are
+	// placed in output coordinates when they are drawn
+	for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+		example_surface *s = *it;
+		if (s != this) {
+			example_surface *hit = s->pick(x, y);
+			if (hit)
+				return hit;
+		} else if (view && view->contain_point(x, y)) {
+			return this;
+		}
+	}
+	return NULL;
+}
+
+void example_surface::draw_tree(int32_t x, int32_t y,
+		presentation_feedback_list_t &frame) {
+	for (auto s : stack) {
+		if (s == this) {
+			draw(x, y, frame);
+		} else {
+			s->draw_tree(x + s->sub_x, y + s->sub_y, frame);
+		}
+	}
 }
-void example_surface::draw() {
+
+void example_surface::draw(int32_t x, int32_t y,
+		presentation_feedback_list_t &frame) {
 
 	glUseProgram(shader->program);
 
@@ -174,60 +248,41 @@ void example_surface::draw() {
 	//static const GLushort elements[] = { 0, 1, 2, 3 };
 
 
-	if (!pending.buffer) {
-		return;
-	}
-
 	if (shader == NULL) {
 		cerr << "No valid shader." << endl;
 		return;
 	}
 
-	int new_x = view->get_left() + pending.sx;
-	int new_y = view->get_top() + pending.sy;
-
-	shm_buffer_t &buf = *pending.buffer;
-
-	int new_width = buf.get_width();
-	int new_height = buf.get_height();
-
-	view->set_geometry(new_x, new_y, new_width, new_height);
+	if (current.newly_attached || pixman_region32_not_empty(&current.damage_surface)
+			|| pixman_region32_not_empty(&current.damage_buffer)) {
+		update_texture();
+	}
 
-	if (pending.newly_attached) {
-		if (buf.get_format() == shm_format::argb8888) {
-			buf.swap_BR_channels();
-		}
-		pending.newly_attached = false;
+	// unmapped, or nothing attached yet
+	if (!texture || !tex_width || !tex_height) {
+		return;
 	}
 
+	// this content reaches the screen with the frame
+	frame.append(current.feedback);
+
 	//cout << "drawing surface(" << resource.get_id() << ")"
 	//	<< "with attached buffer(" << buf.get_resource().get_id() << ")"
 	//	<< endl;
 
-	int port_x = new_x;
-	int port_y = (compositor->get_height()-height-new_y);
-	glViewport(port_x, port_y, new_width, new_height);
+	// subsurfaces are placed by their parent, keep their view in sync
+	if (parent) {
+		view->set_geometry(x, y, tex_width, tex_height);
+	}
+
+	int port_x = x;
+	int port_y = (compositor->get_height()-tex_height-y);
+	glViewport(port_x, port_y, tex_width, tex_height);
 	//glMatrixMode(GL_PROJECTION);
 
 	GLint uniform_tex
 		= glGetUniformLocation(shader->program, "tex");
 
-	GLuint texture;
-
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0,
-			GL_RGBA, 
-			buf.get_width(),
-			buf.get_height(),
-			0,
-			GL_RGBA, GL_UNSIGNED_BYTE,
-			buf.get_data());
-
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture);
 	glUniform1i(uniform_tex, 0);
@@ -262,10 +317,291 @@ void example_surface::draw() {
 
 }
 
+void example_surface::update_texture() {
+	shm_buffer_t *buffer = get_buffer();
+	if (current.newly_attached) {
+		if (parent) {
+			sub_x += current.sx;
+			sub_y += current.sy;
+		} else {
+			view->move(current.sx, current.sy);
+		}
+		current.sx = 0;
+		current.sy = 0;
+	}
+	if (!buffer) {
+		// a NULL buffer unmaps the surface: drop its content and
+		// take it out of the pointer hit tests until the next buffer
+		if (current.newly_attached) {
+			unmap();
+		}
+		current.newly_attached = false;
+		pixman_region32_clear(&current.damage_surface);
+		pixman_region32_clear(&current.damage_buffer);
+		return;
+	}
+
+	shm_buffer_t &buf = *buffer;
+	shm_buffer_access_t access(buffer);
+
+	int new_width = buf.get_width();
+	int new_height = buf.get_height();
+
+	view->set_geometry(view->get_left(), view->get_top(), new_width, new_height);
+
+	if (!texture) {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+	}
+
+	// (re)allocate storage only when the buffer size changes
+	if (tex_width != new_width || tex_height != new_height) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0,
+				GL_RGBA,
+				new_width,
+				new_height,
+				0,
+				GL_RGBA, GL_UNSIGNED_BYTE,
+				NULL);
+		tex_width = new_width;
+		tex_height = new_height;
+		pixman_region32_union_rect(&current.damage_surface,
+				&current.damage_surface,
+				0, 0, new_width, new_height);
+	} else if (current.newly_attached
+			&& !pixman_region32_not_empty(&current.damage_surface)
+			&& !pixman_region32_not_empty(&current.damage_buffer)) {
+		// a new buffer without damage, take it as a whole
+		pixman_region32_union_rect(&current.damage_surface,
+				&current.damage_surface,
+				0, 0, new_width, new_height);
+	}
+
+	current.newly_attached = false;
+
+	// no scaling or transforms, surface and buffer coordinates match
+	pixman_region32_union(&current.damage_surface,
+			&current.damage_surface, &current.damage_buffer);
+	compositor->get_uploader().upload(texture, buf, &current.damage_surface);
+	pixman_region32_clear(&current.damage_surface);
+	pixman_region32_clear(&current.damage_buffer);
+
+	// the texture holds a copy now, redraws don't need the client's
+	// buffer anymore, so hand it back right away
+	if (!current.buffer.is_destroyed()) {
+		current.buffer.send_release();
+	}
+	current.buffer = buffer_resource_t();
+}
+
+void example_surface::unmap() {
+	if (texture) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+	tex_width = 0;
+	tex_height = 0;
+	view->set_geometry(view->get_left(), view->get_top(), 0, 0);
+}
+
+void example_surface::merge_state(state &from, state &to) {
+	if (from.newly_attached) {
+		// committed over before it was drawn, release it unread
+		if (to.buffer && !to.buffer.is_destroyed()) {
+			to.buffer.send_release();
+		}
+		// and the content of those commits is never shown
+		to.feedback.discarded();
+		to.buffer = from.buffer;
+		to.newly_attached = true;
+		to.sx += from.sx;
+		to.sy += from.sy;
+
+		from.buffer = buffer_resource_t();
+		from.newly_attached = false;
+		from.sx = 0;
+		from.sy = 0;
+	}
+
+	pixman_region32_union(&to.damage_surface,
+			&to.damage_surface, &from.damage_surface);
+	pixman_region32_union(&to.damage_buffer,
+			&to.damage_buffer, &from.damage_buffer);
+	pixman_region32_clear(&from.damage_surface);
+	pixman_region32_clear(&from.damage_buffer);
+
+	// commits faster than the output add up and complete together
+	to.frame_callbacks.insert(to.frame_callbacks.end(),
+			from.frame_callbacks.begin(), from.frame_callbacks.end());
+	from.frame_callbacks.clear();
+	to.feedback.append(from.feedback);
+}
+
+void example_surface::discard_state(state &s) {
+	if (s.newly_attached && s.buffer && !s.buffer.is_destroyed()) {
+		s.buffer.send_release();
+	}
+	s.buffer = buffer_resource_t();
+	s.newly_attached = false;
+	s.sx = 0;
+	s.sy = 0;
+	pixman_region32_clear(&s.damage_surface);
+	pixman_region32_clear(&s.damage_buffer);
+	// like weston, frame callbacks of discarded state never get done
+	for (auto &c : s.frame_callbacks) {
+		c.destroy();
+	}
+	s.frame_callbacks.clear();
+	s.feedback.discarded();
+}
+
 void example_surface::commit_state() {
-	//compositor->attach(pending.buffer);
-	//pending.buffer = NULL;
+	if (is_synchronized()) {
+		// shown together with the next commit of the parent
+		merge_state(pending, cached);
+		has_cached = true;
+		return;
+	}
+	if (has_cached) {
+		merge_state(pending, cached);
+		has_cached = false;
+		apply_state(cached);
+	} else {
+		apply_state(pending);
+	}
+}
+
+void example_surface::apply_state(state &s) {
+	merge_state(s, current);
+
+	// the stacking order and positions of the subsurfaces and their
+	// cached state are part of this commit
+	if (stack_dirty) {
+		stack = stack_pending;
+		stack_dirty = false;
+	}
+	for (auto child : stack) {
+		if (child != this)
+			child->parent_committed();
+	}
+}
+
+void example_surface::parent_committed() {
+	if (position_pending) {
+		sub_x = pending_x;
+		sub_y = pending_y;
+		position_pending = false;
+	}
+	if (has_cached && is_synchronized()) {
+		has_cached = false;
+		apply_state(cached);
+	}
+}
+
+bool example_surface::is_synchronized() {
+	return parent && (sync || parent->is_synchronized());
+}
+
+bool example_surface::is_ancestor_of(example_surface *s) {
+	for (; s; s = s->parent) {
+		if (s == this)
+			return true;
+	}
+	return false;
+}
+
+bool example_surface::make_subsurface(subsurface_resource_t sub,
+		example_surface *p) {
+	// a surface has at most one wl_subsurface at a time
+	if (parent || p == this || is_ancestor_of(p))
+		return false;
+	if (!set_role(surface_role::subsurface))
+		return false;
+
+	parent = p;
+	subsurface = sub;
+	sync = true;
+	sub_x = sub_y = 0;
+	position_pending = false;
+	// on top of its siblings, right away like weston does
+	parent->stack.push_back(this);
+	parent->stack_pending.push_back(this);
+
+	// pointer events of the client go to its window, not to a part of it
+	client_t client = resource.get_client();
+	if (compositor->find_view(client) == view)
+		compositor->set_client_view(client, get_root()->get_view());
+
+	sub.on_destroy() = [&]() {
+		subsurface.destroy();
+	};
+
+	sub.on_set_position() = [&](int32_t x, int32_t y) {
+		pending_x = x;
+		pending_y = y;
+		position_pending = true;
+	};
+
+	auto place = [this](surface_resource_t sibling_res, bool above) {
+		example_surface *sibling = compositor->find_surface(sibling_res);
+		auto &order = parent->stack_pending;
+		auto it = std::find(order.begin(), order.end(), sibling);
+		if (!sibling || sibling == this || it == order.end()) {
+			subsurface.post_error(static_cast<uint32_t>(subsurface_error::bad_surface),
+					"sibling is neither the parent nor one of its subsurfaces");
+			return;
+		}
+		order.remove(this);
+		it = std::find(order.begin(), order.end(), sibling);
+		order.insert(above ? std::next(it) : it, this);
+		parent->stack_dirty = true;
+	};
+	sub.on_place_above() = [=](surface_resource_t sibling) {
+		place(sibling, true);
+	};
+	sub.on_place_below() = [=](surface_resource_t sibling) {
+		place(sibling, false);
+	};
 
+	sub.on_set_sync() = [&]() {
+		sync = true;
+	};
+
+	sub.on_set_desync() = [&]() {
+		sync = false;
+		// what waited for the parent is shown right away now
+		if (has_cached && !is_synchronized()) {
+			has_cached = false;
+			apply_state(cached);
+		}
+	};
+
+	// for the destroy request as well as for gone clients
+	sub.add_destroy_listener([&]() {
+		remove_subsurface();
+	});
+	return true;
+}
+
+void example_surface::remove_subsurface() {
+	if (!parent)
+		return;
+	parent->stack.remove(this);
+	parent->stack_pending.remove(this);
+	parent = NULL;
+	// unmapped until it gets a new role, what waited for the parent
+	// is never going to be shown
+	if (has_cached) {
+		discard_state(cached);
+		has_cached = false;
+	}
+	tex_width = 0;
+	tex_height = 0;
 }
 
 void example_shell_surface::bind(shell_surface_resource_t surf) {
@@ -287,6 +623,45 @@ void example_shell_surface::bind(shell_surface_resource_t surf) {
 	};
 }
 
+void example_shell::bind(resource_t res, void *data) {
+	std::cout << "client bind example_shell" << std::endl;
+
+	auto r = new shell_resource_t(res);
+
+	r->on_get_shell_surface() = [=] (shell_surface_resource_t shell_surf, surface_resource_t surf) {
+		example_surface *s = compositor->find_surface(surf);
+		if (!s || !s->set_role(surface_role::shell_surface)) {
+			r->post_error(static_cast<uint32_t>(shell_error::role),
+					"surface already has another role");
+			return;
+		}
+		auto new_shell_surf = new example_shell_surface(compositor);
+		new_shell_surf->bind(shell_surf);
+		//example_shell_surface new_shell_surf;
+		new_shell_surf->bind_surface(surf);
+	};
+}
+
+void example_subcompositor::bind(resource_t res, void *data) {
+	std::cout << "client bind example_subcompositor" << std::endl;
+
+	auto r = new subcompositor_resource_t(res);
+
+	r->on_destroy() = [=]() {
+		r->destroy();
+	};
+
+	r->on_get_subsurface() = [=](subsurface_resource_t sub,
+			surface_resource_t surf, surface_resource_t parent_res) {
+		example_surface *s = compositor->find_surface(surf);
+		example_surface *parent = compositor->find_surface(parent_res);
+		if (!s || !parent || !s->make_subsurface(sub, parent)) {
+			r->post_error(static_cast<uint32_t>(subcompositor_error::bad_surface),
+					"surface already has a role or would become its own ancestor");
+		}
+	};
+}
+
 void example_seat::bind(resource_t res, void *data) {
 	std::cout << "client bind example_seat" << std::endl;
 	res_list.push_back(res);
@@ -300,6 +675,17 @@ void example_seat::bind(resource_t res, void *data) {
 		client_t c = res.get_client();
 		example_view *v = compositor->find_view(c);
 		v->bind_pointer(p);
+
+		res.on_set_cursor() = [=](uint32_t serial, surface_resource_t surf,
+				int32_t hotspot_x, int32_t hotspot_y) {
+			// a NULL surface hides the cursor
+			if (!surf)
+				return;
+			example_surface *s = compositor->find_surface(surf);
+			if (!s || !s->set_role(surface_role::cursor)) {
+				p->post_role_error();
+			}
+		};
 	};
 
 	r.on_get_keyboard() = [&](keyboard_resource_t res) {
@@ -325,7 +711,8 @@ bool example_surface::bind_view(example_view *v) {
 example_compositor::example_compositor(display_server_t disp)
 	: global_t(disp, compositor_interface, 4, this, NULL),
 	display(disp),
-	shell(disp, this), seat(disp, this), shm(disp),
+	shell(disp, this), subcompositor(disp, this), seat(disp, this),
+	shm(disp), presentation(disp),
 	session_active(true),
 	focus(NULL), surface_grabbing(false),
 	prev_pnt_x(0), prev_pnt_y(0)
@@ -347,6 +734,25 @@ example_compositor::example_compositor(display_server_t disp)
 		bind_mem_fn(&example_compositor::frame, this);
 	wrapper.on_quit() =
 		bind_mem_fn(&example_compositor::quit, this);
+	wrapper.on_presented() =
+		bind_mem_fn(&example_compositor::presented, this);
+	wrapper.on_discarded() =
+		bind_mem_fn(&example_compositor::discarded, this);
+	// runs on the wrapper thread, which owns the GL context
+	wrapper.on_finish() = [&]() {
+		uploader.finish();
+	};
+
+	presentation.on_feedback() = [&](surface_resource_t surf,
+			wp_presentation_feedback_resource_t feedback) {
+		example_surface *s = find_surface(surf);
+		if (s) {
+			s->add_feedback(feedback);
+			return;
+		}
+		feedback.send_discarded();
+		feedback.destroy();
+	};
 	wrapper.on_pointer_enter() =
 		bind_mem_fn(&example_compositor::pointer_enter, this);
 	wrapper.on_pointer_motion() =
@@ -370,10 +776,26 @@ void example_compositor::bind(resource_t res, void *data) {
 		surface_list.push_back(s);
 
 		view_list.push_back(v);
-		view_client_dict[surf_res.get_client()] = v;
+		// the first surface usually is the window, subsurfaces are
+		// redirected to their root when they get the role
+		client_t client = surf_res.get_client();
+		if (!find_view(client))
+			set_client_view(client, v);
 	};
 }
 
+void example_compositor::set_client_view(client_t c, example_view *v) {
+	example_view *old = view_client_dict[c];
+	if (old == v)
+		return;
+	if (old) {
+		example_pointer *p = old->release_pointer();
+		if (p)
+			v->bind_pointer(p);
+	}
+	view_client_dict[c] = v;
+}
+
 void example_compositor::pointer_motion(uint32_t time, int32_t x, int32_t y) {
 	//cout << "pointer motion (" << x << ", " << y << ")@"
 	//	<< time << endl;
@@ -387,17 +809,17 @@ void example_compositor::pointer_motion(uint32_t time, int32_t x, int32_t y) {
 		display.wake_epoll();
 		return;
 	}
-	example_view *focus_v = NULL;
-	for (auto &&v : view_list) {
-		if (v->contain_point(x, y)) {
-			focus_v = v;
-			focus = v->get_surface();
-			break;
-			//s->get_resource()->
-		}
+	// windows are drawn in list order, the last one is on top
+	example_surface *hit = NULL;
+	for (auto it = surface_list.rbegin(); it != surface_list.rend() && !hit; ++it) {
+		example_surface *s = *it;
+		if (s->is_toplevel())
+			hit = s->pick(x, y);
 	}
-	if (focus_v) {
-		focus_v->notify_motion(time, x, y);
+	if (hit) {
+		// subsurfaces are moved and get input along with their window
+		focus = hit->get_root();
+		focus->get_view()->notify_motion(time, x, y);
 	}
 }
 
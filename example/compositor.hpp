@@ -22,10 +22,12 @@
  */
 
 #include <sys/time.h>
+#include <time.h>
 #include <stdlib.h>
 #include <assert.h>
 
 #include <iostream>
+#include <deque>
 #include <queue>
 #include <vector>
 #include <list>
@@ -37,20 +39,31 @@
 #include <wayland-shm.hpp>
 
 #include <wayland-server.hpp>
+#include <wayland-presentation.hpp>
 
 #include <pixman-1/pixman.h>
 
 #include "wrapper.hpp"
+#include "uploader.hpp"
 
 class example_compositor;
 class example_view;
 
+/* wl_surface roles, a surface keeps its role once it got one */
+enum class surface_role {
+	none,
+	shell_surface,
+	cursor,
+	subsurface
+};
+
 class example_surface {
 protected:
 	struct state {
 		//shared_ptr<shm_buffer_t> buffer;
 		int newly_attached;
-		wayland::shm_buffer_t *buffer;
+		// the shm_buffer_t goes away with the resource
+		wayland::buffer_resource_t buffer;
 		int32_t sx;
 		int32_t sy;
 		/* wl_surface.damage */
@@ -64,7 +77,13 @@ protected:
 		/* wl_surface.set_input_region */
 		pixman_region32_t input;
 
-		state() : newly_attached(false), buffer(NULL), sx(0), sy(0) {
+		/* wl_surface.frame */
+		std::vector<wayland::callback_resource_t> frame_callbacks;
+
+		/* wp_presentation.feedback */
+		wayland::presentation_feedback_list_t feedback;
+
+		state() : newly_attached(false), sx(0), sy(0) {
 			pixman_region32_init(&damage_buffer);
 			pixman_region32_init(&damage_surface);
 			pixman_region32_init(&opaque);
@@ -73,10 +92,10 @@ protected:
 	};
 
 	wayland::surface_resource_t resource;
+	surface_role role;
 
 	example_compositor *compositor;
 	example_view *view;
-	std::queue<wayland::callback_resource_t> frame_queue;
 
 	/** Damage in local coordinates from the client, for tex upload. */
 	pixman_region32_t damage;                                           
@@ -89,7 +108,34 @@ protected:
 	state pending;
 	state current;
 
+	/* wl_subsurface, the surface is a root of the scene graph without */
+	example_surface *parent;
+	wayland::subsurface_resource_t subsurface;
+	bool sync;
+	// position relative to the parent, set_position waits for its commit
+	int32_t sub_x, sub_y;
+	int32_t pending_x, pending_y;
+	bool position_pending;
+	// commits of a synchronized subsurface wait here for the parent
+	state cached;
+	bool has_cached;
+
+	// this surface and its subsurfaces, bottom to top
+	std::list<example_surface *> stack;
+	// changed by place_above/below, applied on commit
+	std::list<example_surface *> stack_pending;
+	bool stack_dirty;
+
+	void merge_state(state &from, state &to);
+	void discard_state(state &s);
+	void apply_state(state &s);
+	void parent_committed();
+	void remove_subsurface();
+
 	gl_shader *shader;
+	// persistent texture, only damaged parts are uploaded
+	GLuint texture;
+	int32_t tex_width, tex_height;
 
 public:
 	example_surface(example_compositor *c);
@@ -103,9 +149,23 @@ public:
 		return view;
 	}
 
-	void draw();
+	/** Draws the surface with its top-left corner at x, y and, if it
+	 *  has content, moves the feedback of that content to \p frame. */
+	void draw(int32_t x, int32_t y,
+			wayland::presentation_feedback_list_t &frame);
+	/** Draws the surface and its subsurfaces in stacking order,
+	 *  with the top-left corner of this surface at x, y. */
+	void draw_tree(int32_t x, int32_t y,
+			wayland::presentation_feedback_list_t &frame);
 
-	void frame_done();
+	/** Completes the frame callbacks of all states committed so far.
+	 *  \param msecs Time of the output frame, CLOCK_MONOTONIC */
+	void frame_done(uint32_t msecs);
+
+	void add_feedback(wayland::wp_presentation_feedback_resource_t feedback);
+	/** Discards the feedback left over after draw(), its content
+	 *  did not make it to the screen. */
+	void discard_feedback();
 
 	//void notify_motion(int x, int y) {
 	//	
@@ -115,6 +175,35 @@ public:
 	//}
 
 	void commit_state();
+	void update_texture();
+	/** Drops the texture and the input area after a NULL buffer
+	 *  was committed, the view stays in place for the next one. */
+	void unmap();
+
+	surface_role get_role() {
+		return role;
+	}
+	/** Assigns \p r, fails if the surface already has another role. */
+	bool set_role(surface_role r);
+
+	example_surface *get_parent() {
+		return parent;
+	}
+	/** Whether the surface is a root of the scene graph that is shown,
+	 *  cursors are not and former subsurfaces stay unmapped. */
+	bool is_toplevel() {
+		return !parent && role != surface_role::cursor
+			&& role != surface_role::subsurface;
+	}
+	example_surface *get_root();
+	/** Finds the topmost surface of this tree at x, y, in the
+	 *  stacking order of draw_tree(). */
+	example_surface *pick(int32_t x, int32_t y);
+	bool is_ancestor_of(example_surface *s);
+	// synchronized itself or through any of its parents
+	bool is_synchronized();
+	bool make_subsurface(wayland::subsurface_resource_t sub,
+			example_surface *parent);
 
 	wayland::shm_buffer_t *get_buffer();
 	std::vector<int> to_window_space(std::vector<float> v);
@@ -149,6 +238,10 @@ public:
 			wayland::pointer_button_state state) {
 		resource.send_button(serial, time, button, state);
 	}
+	void post_role_error() {
+		resource.post_error(static_cast<uint32_t>(wayland::pointer_error::role),
+				"surface already has another role");
+	}
 
 };
 
@@ -218,6 +311,11 @@ public:
 		pointer = p;
 		return true;
 	}
+	example_pointer *release_pointer() {
+		example_pointer *p = pointer;
+		pointer = NULL;
+		return p;
+	}
 };
 
 //class example_shell_surface : public shell_surface_resource_t {
@@ -268,18 +366,22 @@ public:
 	{
 	}
 
-	virtual void bind(wayland::resource_t res, void *data) {
-		std::cout << "client bind example_shell" << std::endl;
-
-		auto r = new wayland::shell_resource_t(res);
+	virtual void bind(wayland::resource_t res, void *data);
+};
 
-		r->on_get_shell_surface() = [&] (wayland::shell_surface_resource_t shell_surf, wayland::surface_resource_t surf) {
-			auto new_shell_surf = new example_shell_surface(compositor);
-			new_shell_surf->bind(shell_surf);
-			//example_shell_surface new_shell_surf;
-			new_shell_surf->bind_surface(surf);
-		};
+class example_subcompositor : public wayland::global_t {
+	wayland::display_server_t display;
+	example_compositor *compositor;
+public:
+	example_subcompositor(wayland::display_server_t disp,
+			example_compositor *c)
+		: global_t(disp, wayland::detail::subcompositor_interface, 1, this, NULL),
+		display(disp),
+		compositor(c)
+	{
 	}
+
+	virtual void bind(wayland::resource_t res, void *data);
 };
 
 class example_pointer;
@@ -321,10 +423,16 @@ private:
 	display_wrapper_t wrapper;
 
 	example_shell shell;
+	example_subcompositor subcompositor;
 	example_seat seat;
 	wayland::shm_t shm;
+	wayland::presentation_t presentation;
+
+	// feedback of composed frames the parent has not presented yet
+	std::deque<wayland::presentation_feedback_list_t> presenting;
 
 	gl_shader *shader;
+	texture_uploader_t uploader;
 
 	bool running;
 
@@ -454,17 +562,50 @@ public:
 	void frame() {
 		// compose windows
 		// for window list
+		// subsurfaces are drawn along with their parents, cursors
+		// are left to the parent compositor
+		wayland::presentation_feedback_list_t shown;
 		for (auto s : surface_list) {
-			s->draw();
+			if (s->is_toplevel()) {
+				example_view *v = s->get_view();
+				s->draw_tree(v->get_left(), v->get_top(), shown);
+			}
 		}
 
+		// one timestamp for everything shown in this frame
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		uint32_t msecs = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 		for (auto s : surface_list) {
-			s->frame_done();
+			s->frame_done(msecs);
+			s->discard_feedback();
+		}
+		if (wrapper.has_presentation()) {
+			presenting.push_back(shown);
+		} else {
+			// best guess without the parent's feedback
+			shown.presented(ts.tv_sec * 1000000000ull + ts.tv_nsec, 0, 0, 0);
 		}
 
 		display.wake_epoll();
 	}
 
+	void presented(uint64_t time, uint32_t refresh, uint64_t seq, uint32_t flags) {
+		if (presenting.empty())
+			return;
+		// composited, never scanned out from the client's buffer
+		flags &= ~static_cast<uint32_t>(wayland::wp_presentation_feedback_kind::zero_copy);
+		presenting.front().presented(time, refresh, seq, flags);
+		presenting.pop_front();
+	}
+
+	void discarded() {
+		if (presenting.empty())
+			return;
+		presenting.front().discarded();
+		presenting.pop_front();
+	}
+
 	void quit() {
 		cout << "quiting..." << endl;
 		running = false;
@@ -488,9 +629,24 @@ public:
 		return shader;
 	}
 
+	texture_uploader_t &get_uploader() {
+		return uploader;
+	}
+
 	example_view *find_view(wayland::client_t c) {
 		return view_client_dict[c];
 	}
+	/** Makes \p v the view that gets the pointer events of client
+	 *  \p c, the pointer moves over if it was bound already. */
+	void set_client_view(wayland::client_t c, example_view *v);
+
+	example_surface *find_surface(wayland::surface_resource_t res) {
+		for (auto s : surface_list) {
+			if (s->get_resource().c_ptr() == res.c_ptr())
+				return s;
+		}
+		return NULL;
+	}
 
 	void start_grabbing_surface() {
 		surface_grabbing = true;
@@ -30,11 +30,14 @@
 #include <stdexcept>
 #include <iostream>
 #include <array>
+#include <vector>
+#include <memory>
 #include <wayland-client.hpp>
-#include <wayland-egl.hpp>
+#include <wayland-egl-surface.hpp>
 #include <GLES2/gl2.h>
 #include <linux/input.h>
 #include <wayland-cursor.hpp>
+#include <poll.h>
 
 #include <CImg.h>
 
@@ -223,18 +226,17 @@ class example {
 	shell_surface_proxy_t shell_surface;
 	pointer_proxy_t pointer;
 	keyboard_proxy_t keyboard;
-	callback_proxy_t frame_cb;
-	cursor_theme_t cursor_theme;
-	cursor_image_t cursor_image;
-	buffer_proxy_t cursor_buffer;
-	surface_proxy_t cursor_surface;
+	std::unique_ptr<cursor_manager_t> cursors;
 
 	// EGL
-	egl_window_t egl_window;
+	std::unique_ptr<egl_surface_t> egl_surface;
 	EGLDisplay egldisplay;
-	EGLSurface eglsurface;
 	EGLContext eglcontext;
 	gl_shader shader;
+	GLuint texture;
+
+	// what changed since the last frame
+	std::vector<egl_rect_t> damage;
 
 	bool running;
 	bool has_pointer;
@@ -283,15 +285,18 @@ class example {
 		if(eglcontext == EGL_NO_CONTEXT)
 			throw std::runtime_error("eglCreateContext");
 
-		eglsurface = eglCreateWindowSurface(egldisplay, config, egl_window, NULL);
-		if(eglsurface == EGL_NO_SURFACE)
-			throw std::runtime_error("eglCreateWindowSurface");
+		egl_surface = std::unique_ptr<egl_surface_t>(new egl_surface_t(egldisplay, config, surface, width, height));
+		egl_surface->make_current(eglcontext);
 
-		if(eglMakeCurrent(egldisplay, eglsurface, eglsurface, eglcontext) == EGL_FALSE)
-			throw std::runtime_error("eglMakeCurrent");
+		// repaint as soon as the compositor is ready, if anything changed
+		egl_surface->on_frame() = bind_mem_fn(&example::draw, this);
 	}
 
 	void draw(uint32_t serial = 0) {
+		// nothing changed, don't push a frame
+		if(damage.empty() || egl_surface->is_frame_pending())
+			return;
+
 		float h = ((serial >> 4) & 0xFF) / 255.0;
 		float s = 1, v = 1;
 
@@ -351,37 +356,40 @@ class example {
 		GLint uniform_tex
 			= glGetUniformLocation(shader.program, "tex");
 
-		GLuint tex;
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexImage2D(GL_TEXTURE_2D, 0,
-					GL_RGB, 
-					width,
-					height,
-					0,
-					GL_RGB, GL_UNSIGNED_BYTE,
-					image_data);
+		// the image never changes, upload it once
+		if(!texture) {
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0,
+						GL_RGB, 
+						width,
+						height,
+						0,
+						GL_RGB, GL_UNSIGNED_BYTE,
+						image_data);
+		}
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, tex);
+		glBindTexture(GL_TEXTURE_2D, texture);
 		glUniform1i(uniform_tex, 0);
 
 		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, &verts);
 		glEnableVertexAttribArray(0);
 
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		// only touch what changed, the rest of the back buffer is kept
+		glEnable(GL_SCISSOR_TEST);
+		for(auto &r : egl_surface->get_repaint_region(damage)) {
+			glScissor(r.x, height - r.y - r.height, r.width, r.height);
+			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		}
+		glDisable(GL_SCISSOR_TEST);
 
 		glDisableVertexAttribArray(0);
-		
-
-		// schedule next draw
-		frame_cb = surface.frame();
-		frame_cb.on_done() = bind_mem_fn(&example::draw, this);
 
-		// swap buffers
-		if(eglSwapBuffers(egldisplay, eglsurface) == EGL_FALSE)
-			throw std::runtime_error("eglSwapBuffers");
+		// swap buffers, also requests the next frame callback
+		egl_surface->swap_buffers(damage);
+		damage.clear();
 	}
 
   public:
@@ -401,18 +409,14 @@ class example {
 		
 
 		// retrieve global objects
-		registry = display.get_registry();
-		registry.on_global() = [&](uint32_t name, std::string interface, uint32_t version) {
-			if(interface == "wl_compositor")
-				registry.bind(name, compositor, version);
-			else if(interface == "wl_shell")
-				registry.bind(name, shell, version);
-			else if(interface == "wl_seat")
-				registry.bind(name, seat, version);
-			else if(interface == "wl_shm")
-				registry.bind(name, shm, version);
-		};
-		display.dispatch();
+		registry_binder_t binder({
+			{ compositor },
+			{ shell },
+			{ seat },
+			{ shm },
+		});
+		if(!binder.bind(display, registry))
+			throw std::runtime_error("Missing global " + binder.get_missing().front() + ".");
 
 		seat.on_capabilities() = [&](seat_capability capability) {
 			has_keyboard = capability & seat_capability::keyboard;
@@ -440,20 +444,12 @@ class example {
 		keyboard = seat.get_keyboard();
 
 		// load cursor theme
-		cursor_theme = cursor_theme_t("default", 16, shm);
-		cursor_t cursor = cursor_theme.get_cursor("cross");
-		cursor_image = cursor.image(0);
-		cursor_buffer = cursor_image.get_buffer();
-
-		// create cursor surface
-		cursor_surface = compositor.create_surface();
-
-		// draw cursor
-		pointer.on_enter() = [&](uint32_t serial, surface_proxy_t, int32_t, int32_t) {
-			cursor_surface.attach(cursor_buffer, 0, 0);
-			cursor_surface.damage(0, 0, cursor_image.width(), cursor_image.height());
-			cursor_surface.commit();
-			pointer.set_cursor(serial, cursor_surface, 0, 0);
+		cursors = std::unique_ptr<cursor_manager_t>(new cursor_manager_t(compositor, shm, "default", 16));
+		cursors->preload("cross");
+
+		// draw cursor, only committed when the frame changes
+		pointer.on_enter() = [&](uint32_t serial, surface_proxy_t, fixed_t, fixed_t) {
+			cursors->set_cursor(pointer, serial, "cross");
 		};
 
 		pointer.on_motion() = [&](uint32_t time, fixed_t x, fixed_t y) {
@@ -473,17 +469,18 @@ class example {
 		};
 
 		// intitialize egl
-		//egl_window = egl_window_t(surface, 320, 240);
-		egl_window = egl_window_t(surface, width, height);
+		texture = 0;
 		init_egl();
 
 		shader.init();
 
 		// draw stuff
+		damage.push_back({ 0, 0, width, height });
 		draw();
 	}
 
 	~example() {
+		egl_surface.reset();
 		// finialize EGL
 		//if(eglDestroyContext(egldisplay, eglcontext) == EGL_FALSE)
 		//	throw std::runtime_error("eglDestroyContext");
@@ -494,10 +491,28 @@ class example {
 	}
 
 	void run() {
-		// event loop
+		// event loop, also waits for the cursor animation timer
+		std::array<pollfd, 2> fds = {{
+			{ display.get_fd(), POLLIN, 0 },
+			{ cursors->get_fd(), POLLIN, 0 }
+		}};
 		running = true;
-		while(running)
-			display.dispatch();
+		while(running) {
+			while(display.prepare_read() != 0)
+				display.dispatch_pending();
+			display.flush();
+			if(poll(fds.data(), fds.size(), -1) < 0) {
+				display.cancel_read();
+				throw std::runtime_error("poll failed.");
+			}
+			if(fds[0].revents & POLLIN)
+				display.read_events();
+			else
+				display.cancel_read();
+			display.dispatch_pending();
+			if(fds[1].revents & POLLIN)
+				cursors->dispatch();
+		}
 	}
 };
 
@@ -36,13 +36,10 @@
 #include <algorithm>
 
 #include <wayland-client.hpp>
+#include <wayland-client-shm.hpp>
 #include <linux/input.h>
 #include <wayland-cursor.hpp>
-
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <poll.h>
 
 using namespace wayland;
 
@@ -54,86 +51,26 @@ std::function<R(Args...)> bind_mem_fn(R(T::* func)(Args...), T *t) {
 	};
 }
 
-// shared memory helper class
-class shared_mem_t {
-  private:
-	std::string name;
-	int fd;
-	size_t len;
-	void *mem;
-
-  public:
-	shared_mem_t()
-		: name(""), fd(0), len(0), mem(nullptr) {
-	}
-
-	shared_mem_t(size_t size) {
-		// create random filename
-		std::stringstream ss;
-		std::srand(std::time(0));
-		ss << '/' << std::rand();
-		name = ss.str();
-
-		// open shared memory file
-		fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
-		if(fd < 0)
-			throw std::runtime_error("shm_open failed.");
-
-		// set size
-		if(ftruncate(fd, size) < 0)
-			throw std::runtime_error("ftruncate failed.");
-
-		// map memory
-		mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-		if(mem == MAP_FAILED)
-			throw std::runtime_error("mmap failed.");
-	}
-
-	~shared_mem_t() {
-		if(fd) {
-			if(munmap(mem, len) < 0)
-				throw std::runtime_error("munmap failed.");
-			if(close(fd) < 0)
-				throw std::runtime_error("close failed.");
-			if(shm_unlink(name.c_str()) < 0)
-				throw std::runtime_error("shm_unlink failed");
-		}
-	}
-
-	int get_fd() {
-		return fd;
-	}
-
-	void *get_mem() {
-		return mem;
-	}
-};
-
 // example Wayland client
 class example {
   private:
 	// global objects
-	display_t display;
-	registry_t registry;
-	compositor_t compositor;
-	shell_t shell;
-	seat_t seat;
-	shm_t shm;
+	display_client_t display;
+	registry_proxy_t registry;
+	compositor_proxy_t compositor;
+	shell_proxy_t shell;
+	seat_proxy_t seat;
+	shm_proxy_t shm;
 
 	// local objects
-	surface_t surface;
-	shell_surface_t shell_surface;
-	pointer_t pointer;
-	keyboard_t keyboard;
-	callback_t frame_cb;
-	cursor_theme_t cursor_theme;
-	cursor_image_t cursor_image;
-	buffer_t cursor_buffer;
-	surface_t cursor_surface;
+	surface_proxy_t surface;
+	shell_surface_proxy_t shell_surface;
+	pointer_proxy_t pointer;
+	keyboard_proxy_t keyboard;
+	std::unique_ptr<frame_scheduler_t> frames;
+	std::unique_ptr<cursor_manager_t> cursors;
 
-	std::shared_ptr<shared_mem_t> shared_mem;
-	buffer_t buffer[2];
-	int cur_buf;
+	std::unique_ptr<shm_buffer_pool_t> buffer_pool;
 
 	bool running;
 	bool has_pointer;
@@ -189,35 +126,33 @@ class example {
 		                 | (static_cast<uint32_t>(g * 255.0) << 8)
 		                 | static_cast<uint32_t>(b * 255.0);
 
-		std::fill_n(static_cast<uint32_t*>(shared_mem->get_mem()) + cur_buf * 320 * 240, 320 * 240, pixel);
-		surface.attach(buffer[cur_buf], 0, 0);
-		surface.damage(0, 0, 320, 240);
-		if(!cur_buf)
-			cur_buf = 1;
-		else
-			cur_buf = 0;
+		// keep animating, the next frame starts after this one is shown
+		frames->schedule();
+
+		// all buffers still in use by the compositor, skip this frame
+		shm_pool_buffer_t buffer = buffer_pool->acquire(320, 240, 320 * 4, shm_format::argb8888);
+		if(!buffer) {
+			surface.commit();
+			return;
+		}
 
-		// schedule next draw
-		frame_cb = surface.frame();
-		frame_cb.on_done() = bind_mem_fn(&example::draw, this);
+		std::fill_n(static_cast<uint32_t*>(buffer.get_data()), 320 * 240, pixel);
+		surface.attach(buffer.get_buffer(), 0, 0);
+		surface.damage(0, 0, 320, 240);
 		surface.commit();
 	}
 
   public:
 	example() {
 		// retrieve global objects
-		registry = display.get_registry();
-		registry.on_global() = [&](uint32_t name, std::string interface, uint32_t version) {
-			if(interface == "wl_compositor")
-				registry.bind(name, compositor, version);
-			else if(interface == "wl_shell")
-				registry.bind(name, shell, version);
-			else if(interface == "wl_seat")
-				registry.bind(name, seat, version);
-			else if(interface == "wl_shm")
-				registry.bind(name, shm, version);
-		};
-		display.dispatch();
+		registry_binder_t binder({
+			{ compositor },
+			{ shell },
+			{ seat },
+			{ shm },
+		});
+		if(!binder.bind(display, registry))
+			throw std::runtime_error("Missing global " + binder.get_missing().front() + ".");
 
 		seat.on_capabilities() = [&](seat_capability capability) {
 			has_keyboard = capability & seat_capability::keyboard;
@@ -230,12 +165,8 @@ class example {
 		if(!has_pointer)
 			throw std::runtime_error("No pointer found.");
 
-		// create shared memory
-		shared_mem = std::shared_ptr<shared_mem_t>(new shared_mem_t(2 * 320 * 240 * 4));
-		auto pool = shm.create_pool(shared_mem->get_fd(), 2 * 320 * 240 * 4);
-		for(unsigned int c = 0; c < 2; c++)
-			buffer[c] = pool.create_buffer(c * 320 * 240 * 4, 320, 240, 320 * 4, shm_format::argb8888);
-		cur_buf = 0;
+		// create shared memory, room for double buffering up front
+		buffer_pool = std::unique_ptr<shm_buffer_pool_t>(new shm_buffer_pool_t(shm, 2 * 320 * 240 * 4));
 
 		// create a surface
 		surface = compositor.create_surface();
@@ -252,20 +183,12 @@ class example {
 		keyboard = seat.get_keyboard();
 
 		// load cursor theme
-		cursor_theme = cursor_theme_t("default", 16, shm);
-		cursor_t cursor = cursor_theme.get_cursor("cross");
-		cursor_image = cursor.image(0);
-		cursor_buffer = cursor_image.get_buffer();
+		cursors = std::unique_ptr<cursor_manager_t>(new cursor_manager_t(compositor, shm, "default", 16));
+		cursors->preload("cross");
 
-		// create cursor surface
-		cursor_surface = compositor.create_surface();
-
-		// draw cursor
-		pointer.on_enter() = [&](uint32_t serial, surface_t, int32_t, int32_t) {
-			cursor_surface.attach(cursor_buffer, 0, 0);
-			cursor_surface.damage(0, 0, cursor_image.width(), cursor_image.height());
-			cursor_surface.commit();
-			pointer.set_cursor(serial, cursor_surface, 0, 0);
+		// draw cursor, only committed when the frame changes
+		pointer.on_enter() = [&](uint32_t serial, surface_proxy_t, fixed_t, fixed_t) {
+			cursors->set_cursor(pointer, serial, "cross");
 		};
 
 		// window movement
@@ -280,18 +203,42 @@ class example {
 				running = false;
 		};
 
-		// draw stuff
-		draw();
+		// draw stuff, paced by frame callbacks
+		frames = std::unique_ptr<frame_scheduler_t>(new frame_scheduler_t(surface));
+		frames->on_redraw() = bind_mem_fn(&example::draw, this);
+		frames->set_late_start(true);
+		frames->schedule();
 	}
 
 	~example() {
 	}
 
 	void run() {
-		// event loop
+		// event loop, also waits for the cursor and redraw timers
+		std::array<pollfd, 3> fds = {{
+			{ display.get_fd(), POLLIN, 0 },
+			{ cursors->get_fd(), POLLIN, 0 },
+			{ frames->get_fd(), POLLIN, 0 }
+		}};
 		running = true;
-		while(running)
-			display.dispatch();
+		while(running) {
+			while(display.prepare_read() != 0)
+				display.dispatch_pending();
+			display.flush();
+			if(poll(fds.data(), fds.size(), -1) < 0) {
+				display.cancel_read();
+				throw std::runtime_error("poll failed.");
+			}
+			if(fds[0].revents & POLLIN)
+				display.read_events();
+			else
+				display.cancel_read();
+			display.dispatch_pending();
+			if(fds[1].revents & POLLIN)
+				cursors->dispatch();
+			if(fds[2].revents & POLLIN)
+				frames->dispatch();
+		}
 	}
 };
 
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016-2017 Yisu Peng
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+#include "uploader.hpp"
+
+using namespace wayland;
+
+// OpenGL ES 3 names, so the example still builds against ES 2 headers
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_RANGE_BIT
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_UNPACK_ROW_LENGTH_EXT
+#define GL_UNPACK_ROW_LENGTH_EXT 0x0CF2
+#endif
+#ifndef GL_UNPACK_SKIP_ROWS_EXT
+#define GL_UNPACK_SKIP_ROWS_EXT 0x0CF3
+#endif
+#ifndef GL_UNPACK_SKIP_PIXELS_EXT
+#define GL_UNPACK_SKIP_PIXELS_EXT 0x0CF4
+#endif
+
+// OpenGL ES 3 entry points, looked up at runtime
+typedef struct __GLsync *sync_t;
+typedef void *(GL_APIENTRY *map_buffer_range_t)(GLenum, GLintptr,
+		GLsizeiptr, GLbitfield);
+typedef GLboolean (GL_APIENTRY *unmap_buffer_t)(GLenum);
+typedef sync_t (GL_APIENTRY *fence_sync_t)(GLenum, GLbitfield);
+typedef GLenum (GL_APIENTRY *client_wait_sync_t)(sync_t, GLbitfield, uint64_t);
+typedef void (GL_APIENTRY *delete_sync_t)(sync_t);
+
+static map_buffer_range_t map_buffer_range;
+static unmap_buffer_t unmap_buffer;
+static fence_sync_t fence_sync;
+static client_wait_sync_t client_wait_sync;
+static delete_sync_t delete_sync;
+
+static bool has_extension(const char *extensions, const char *name) {
+	size_t len = strlen(name);
+	const char *p = extensions;
+	while ((p = strstr(p, name))) {
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+	return false;
+}
+
+texture_uploader_t::texture_uploader_t(unsigned int ring_size)
+	: initialized(false), has_pbo(false), has_unpack_subimage(false),
+	ring(std::max(ring_size, 1u)), next_slot(0)
+{
+	for (auto &slot : ring) {
+		slot.pbo = 0;
+		slot.size = 0;
+		slot.fence = NULL;
+	}
+}
+
+texture_uploader_t::~texture_uploader_t() {
+	// GL objects are released by finish(), the context may be gone here
+}
+
+void texture_uploader_t::init() {
+	initialized = true;
+
+	const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+	const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+	int major = 0;
+	if (!version || sscanf(version, "OpenGL ES %d", &major) != 1)
+		major = 0;
+
+	if (major >= 3) {
+		map_buffer_range = reinterpret_cast<map_buffer_range_t>(eglGetProcAddress("glMapBufferRange"));
+		unmap_buffer = reinterpret_cast<unmap_buffer_t>(eglGetProcAddress("glUnmapBuffer"));
+		fence_sync = reinterpret_cast<fence_sync_t>(eglGetProcAddress("glFenceSync"));
+		client_wait_sync = reinterpret_cast<client_wait_sync_t>(eglGetProcAddress("glClientWaitSync"));
+		delete_sync = reinterpret_cast<delete_sync_t>(eglGetProcAddress("glDeleteSync"));
+		has_pbo = map_buffer_range && unmap_buffer && fence_sync
+			&& client_wait_sync && delete_sync;
+	}
+	// GL_UNPACK_ROW_LENGTH and friends are core in ES 3
+	has_unpack_subimage = major >= 3
+		|| (extensions && has_extension(extensions, "GL_EXT_unpack_subimage"));
+
+	if (has_pbo) {
+		for (auto &slot : ring)
+			glGenBuffers(1, &slot.pbo);
+	}
+}
+
+texture_uploader_t::slot_t &texture_uploader_t::acquire_slot(GLsizeiptr size) {
+	slot_t &slot = ring[next_slot];
+	next_slot = (next_slot + 1) % ring.size();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+
+	bool orphan = slot.size < size;
+	if (slot.fence) {
+		// never wait for the GPU: if it still reads from this slot,
+		// let the driver hand out fresh storage instead
+		GLenum status = client_wait_sync(slot.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			orphan = true;
+		delete_sync(slot.fence);
+		slot.fence = NULL;
+	}
+	if (orphan) {
+		slot.size = std::max(slot.size, size);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.size, NULL, GL_STREAM_DRAW);
+	}
+	return slot;
+}
+
+void texture_uploader_t::upload_pbo(shm_buffer_t &buffer,
+		shm_converter_t &converter, const std::vector<shm_rect_t> &rects)
+{
+	GLsizeiptr total = 0;
+	for (auto &r : rects)
+		total += static_cast<GLsizeiptr>(r.width) * r.height * 4;
+
+	slot_t &slot = acquire_slot(total);
+	// unsynchronized is safe, the slot is either idle or freshly orphaned
+	uint8_t *dst = static_cast<uint8_t *>(map_buffer_range(GL_PIXEL_UNPACK_BUFFER,
+				0, total, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+				| GL_MAP_UNSYNCHRONIZED_BIT));
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		upload_staging(buffer, converter, rects);
+		return;
+	}
+
+	GLsizeiptr offset = 0;
+	for (auto &r : rects) {
+		converter.convert(buffer, dst + offset, r.width * 4, r);
+		offset += static_cast<GLsizeiptr>(r.width) * r.height * 4;
+	}
+	unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+
+	offset = 0;
+	for (auto &r : rects) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
+				GL_RGBA, GL_UNSIGNED_BYTE,
+				reinterpret_cast<const void *>(offset));
+		offset += static_cast<GLsizeiptr>(r.width) * r.height * 4;
+	}
+	slot.fence = fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void texture_uploader_t::upload_direct(shm_buffer_t &buffer,
+		const std::vector<shm_rect_t> &rects)
+{
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, buffer.get_stride() / 4);
+	for (auto &r : rects) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
+				GL_RGBA, GL_UNSIGNED_BYTE, buffer.get_data());
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+}
+
+void texture_uploader_t::upload_staging(shm_buffer_t &buffer,
+		shm_converter_t &converter, const std::vector<shm_rect_t> &rects)
+{
+	for (auto &r : rects) {
+		staging.resize(static_cast<size_t>(r.width) * r.height * 4);
+		converter.convert(buffer, staging.data(), r.width * 4, r);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
+				GL_RGBA, GL_UNSIGNED_BYTE, staging.data());
+	}
+}
+
+void texture_uploader_t::upload(GLuint texture, shm_buffer_t &buffer,
+		pixman_region32_t *damage)
+{
+	if (!initialized)
+		init();
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+	pixman_region32_intersect_rect(&clip, damage, 0, 0,
+			buffer.get_width(), buffer.get_height());
+
+	int n;
+	pixman_box32_t *boxes = pixman_region32_rectangles(&clip, &n);
+	std::vector<shm_rect_t> rects;
+	rects.reserve(n);
+	for (int i = 0; i < n; i++) {
+		rects.push_back({ boxes[i].x1, boxes[i].y1,
+				boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 });
+	}
+	pixman_region32_fini(&clip);
+
+	if (rects.empty())
+		return;
+
+	shm_converter_t converter(buffer.get_format());
+	if (has_pbo)
+		upload_pbo(buffer, converter, rects);
+	else if (has_unpack_subimage && converter.is_passthrough()
+			&& buffer.get_stride() % 4 == 0)
+		upload_direct(buffer, rects);
+	else
+		upload_staging(buffer, converter, rects);
+}
+
+const char *texture_uploader_t::get_path() {
+	if (!initialized)
+		return "none";
+	if (has_pbo)
+		return "pbo";
+	if (has_unpack_subimage)
+		return "unpack-subimage";
+	return "staging";
+}
+
+void texture_uploader_t::finish() {
+	for (auto &slot : ring) {
+		if (slot.fence) {
+			delete_sync(slot.fence);
+			slot.fence = NULL;
+		}
+		if (slot.pbo) {
+			glDeleteBuffers(1, &slot.pbo);
+			slot.pbo = 0;
+		}
+		slot.size = 0;
+	}
+	initialized = false;
+	has_pbo = false;
+	has_unpack_subimage = false;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2016-2017 Yisu Peng
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UPLOADER_HPP_
+#define __UPLOADER_HPP_
+
+#include <vector>
+
+#include <GLES2/gl2.h>
+#include <pixman-1/pixman.h>
+
+#include <wayland-shm.hpp>
+#include <wayland-shm-convert.hpp>
+
+/** \brief Uploads damaged parts of SHM buffers into persistent textures.
+
+    Three paths are used, picked once the GL context is current:
+
+    - With OpenGL ES 3 the damaged rectangles are converted straight
+      from the SHM pool into a ring of pixel unpack buffers and the
+      texture is updated from the buffer object. A fence is inserted
+      after each upload, so a slot is only written again once the
+      GPU is done reading it. If the next slot is still busy, its
+      storage is orphaned instead of stalling the render thread.
+    - With GL_EXT_unpack_subimage, buffers already in the native
+      layout are uploaded directly from the pool, with the row length
+      and skip parameters describing the client's stride.
+    - Otherwise the damaged rectangles are converted into a staging
+      buffer and uploaded from there.
+
+    In every case the client's buffer is not read anymore once
+    upload() returns.
+*/
+class texture_uploader_t {
+private:
+	struct slot_t {
+		GLuint pbo;
+		GLsizeiptr size;
+		struct __GLsync *fence;
+	};
+
+	bool initialized;
+	bool has_pbo;
+	bool has_unpack_subimage;
+
+	std::vector<slot_t> ring;
+	unsigned int next_slot;
+	std::vector<uint8_t> staging;
+
+	void init();
+	slot_t &acquire_slot(GLsizeiptr size);
+	void upload_pbo(wayland::shm_buffer_t &buffer,
+			wayland::shm_converter_t &converter,
+			const std::vector<wayland::shm_rect_t> &rects);
+	void upload_direct(wayland::shm_buffer_t &buffer,
+			const std::vector<wayland::shm_rect_t> &rects);
+	void upload_staging(wayland::shm_buffer_t &buffer,
+			wayland::shm_converter_t &converter,
+			const std::vector<wayland::shm_rect_t> &rects);
+
+public:
+	/** \brief Create an uploader
+	    \param ring_size Number of pixel unpack buffers used with ES 3
+	*/
+	texture_uploader_t(unsigned int ring_size = 3);
+	~texture_uploader_t();
+
+	/** \brief Update a texture from a SHM buffer
+	    \param texture Texture of the same size as the buffer
+	    \param buffer Source buffer, accessed through shm_buffer_access_t
+	    \param damage Damaged region in buffer coordinates
+
+	    Must be called on the thread owning the GL context. The
+	    texture is left bound to GL_TEXTURE_2D.
+	*/
+	void upload(GLuint texture, wayland::shm_buffer_t &buffer,
+			pixman_region32_t *damage);
+
+	/** \brief Name of the upload path in use
+	    \return "pbo", "unpack-subimage", "staging" or "none" before the
+	    first upload
+	*/
+	const char *get_path();
+
+	/** \brief Release all GL objects
+	    Must be called with the GL context current.
+	*/
+	void finish();
+};
+
+#endif
@@ -28,10 +28,12 @@
  * This is an display_wrapper_t of how to use the Wayland C++ bindings with OpenGL ES.
  */
 
+#include <time.h>
 #include <stdexcept>
 #include <iostream>
 #include <array>
 #include <future>
+#include <memory>
 
 #include <wayland-util.hpp>
 #include <wayland-client.hpp>
@@ -40,6 +42,7 @@
 #include <GLES2/gl2ext.h>
 #include <linux/input.h>
 #include <wayland-cursor.hpp>
+#include <wayland-client-presentation.hpp>
 
 #include "wrapper.hpp"
 #include "helper.hpp"
@@ -167,17 +170,16 @@ static compositor_proxy_t compositor;
 static shell_proxy_t shell;
 static seat_proxy_t seat;
 static shm_proxy_t shm;
+static wp_presentation_proxy_t presentation;
 
 // local objects
 static surface_proxy_t surface;
 static shell_surface_proxy_t shell_surface;
 static pointer_proxy_t pointer;
 static keyboard_proxy_t keyboard;
-static callback_proxy_t frame_cb;
-static cursor_theme_t cursor_theme;
-static cursor_image_t cursor_image;
-static buffer_proxy_t cursor_buffer;
-static surface_proxy_t cursor_surface;
+static std::unique_ptr<frame_scheduler_t> frames;
+static std::unique_ptr<presentation_tracker_t> tracker;
+static std::unique_ptr<cursor_manager_t> cursors;
 
 // EGL
 static egl_window_t egl_window;
@@ -248,13 +250,19 @@ void display_wrapper_t::init_egl() {
 		throw std::runtime_error("eglChooseConfig");
 	}
 
+	// prefer OpenGL ES 3, texture uploads then go through
+	// pixel buffer objects
 	std::array<EGLint, 3> context_attribs = {{
-		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_CONTEXT_CLIENT_VERSION, 3,
 			EGL_NONE
 	}
 	};
 
 	eglcontext = eglCreateContext(egldisplay, config, EGL_NO_CONTEXT, context_attribs.data());
+	if(eglcontext == EGL_NO_CONTEXT) {
+		context_attribs[1] = 2;
+		eglcontext = eglCreateContext(egldisplay, config, EGL_NO_CONTEXT, context_attribs.data());
+	}
 	if(eglcontext == EGL_NO_CONTEXT)
 		throw std::runtime_error("eglCreateContext");
 
@@ -264,6 +272,9 @@ void display_wrapper_t::init_egl() {
 
 	if(eglMakeCurrent(egldisplay, eglsurface, eglsurface, eglcontext) == EGL_FALSE)
 		throw std::runtime_error("eglMakeCurrent");
+
+	// frame_scheduler_t paces the swaps
+	eglSwapInterval(egldisplay, 0);
 }
 
 void display_wrapper_t::draw(uint32_t serial) {
@@ -272,9 +283,8 @@ void display_wrapper_t::draw(uint32_t serial) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 
-	// schedule next draw
-	frame_cb = surface.frame();
-	frame_cb.on_done() = bind_mem_fn(&display_wrapper_t::draw, this);
+	// the composition changes all the time, draw again next frame
+	frames->schedule();
 
 	//callback_t func = callback_dict["frame"];
 	//if (func) {
@@ -294,18 +304,15 @@ display_wrapper_t::display_wrapper_t() {
 
 	display = display_client_t(std::string("wayland-0"));
 	// retrieve global objects
-	registry = display.get_registry();
-	registry.on_global() = [&](uint32_t name, std::string interface, uint32_t version) {
-		if(interface == "wl_compositor")
-			registry.bind(name, compositor, version);
-		else if(interface == "wl_shell")
-			registry.bind(name, shell, version);
-		else if(interface == "wl_seat")
-			registry.bind(name, seat, version);
-		else if(interface == "wl_shm")
-			registry.bind(name, shm, version);
-	};
-	display.dispatch();
+	registry_binder_t binder({
+		{ compositor },
+		{ shell },
+		{ seat },
+		{ shm },
+		{ presentation, 1, UINT32_MAX, false },
+	});
+	if(!binder.bind(display, registry))
+		throw std::runtime_error("Missing global " + binder.get_missing().front() + ".");
 
 	seat.on_capabilities() = [&](seat_capability capability) {
 		has_keyboard = capability & seat_capability::keyboard;
@@ -328,25 +335,40 @@ display_wrapper_t::display_wrapper_t() {
 	shell_surface.set_title("Window");
 	shell_surface.set_toplevel();
 
+	// paces the swaps once run() started drawing
+	frames = std::unique_ptr<frame_scheduler_t>(new frame_scheduler_t(surface));
+	frames->on_redraw() = bind_mem_fn(&display_wrapper_t::draw, this);
+
+	// before the next dispatch, which delivers the clock of the parent
+	if(presentation) {
+		tracker = std::unique_ptr<presentation_tracker_t>(new presentation_tracker_t(presentation, surface, frames.get()));
+		tracker->on_presented() = [&](uint64_t time, uint32_t refresh, uint64_t seq, wp_presentation_feedback_kind flags) {
+			// our own clients are told CLOCK_MONOTONIC
+			if(tracker->get_clock() != CLOCK_MONOTONIC) {
+				timespec ts;
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				time = static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+			}
+			if(presented_callback)
+				presented_callback(time, refresh, seq, static_cast<uint32_t>(flags));
+		};
+		tracker->on_discarded() = [&]() {
+			if(discarded_callback)
+				discarded_callback();
+		};
+	}
+
 	// Get input devices
 	pointer = seat.get_pointer();
 	keyboard = seat.get_keyboard();
 
 	// load cursor theme
-	cursor_theme = cursor_theme_t("default", 16, shm);
-	cursor_t cursor = cursor_theme.get_cursor("arrow");
-	cursor_image = cursor.image(0);
-	cursor_buffer = cursor_image.get_buffer();
-
-	// create cursor surface
-	cursor_surface = compositor.create_surface();
+	cursors = std::unique_ptr<cursor_manager_t>(new cursor_manager_t(compositor, shm, "default", 16));
+	cursors->preload("arrow");
 
-	// draw cursor
+	// draw cursor, only committed when the frame changes
 	pointer.on_enter() = [&](uint32_t serial, surface_proxy_t surf_proxy, fixed_t x, fixed_t y) {
-		cursor_surface.attach(cursor_buffer, 0, 0);
-		cursor_surface.damage(0, 0, cursor_image.width(), cursor_image.height());
-		cursor_surface.commit();
-		pointer.set_cursor(serial, cursor_surface, 0, 0);
+		cursors->set_cursor(pointer, serial, "arrow");
 
 		//pointer_enter_callback(owner, serial, surf_proxy, x, y);
 	};
@@ -416,12 +438,16 @@ void display_wrapper_t::run() {
 	initialized_shader.set_value(&shader);
 
 	// draw stuff
-	draw();
+	frames->schedule();
 
 	// event loop
 	running = true;
 	while(running)
 		display.dispatch();
+
+	// release GL objects while their context is still current
+	if(finish_callback)
+		finish_callback();
 }
 
 void display_wrapper_t::dispatch() {
@@ -456,6 +482,18 @@ decltype(display_wrapper_t::quit_callback) &
 display_wrapper_t::on_quit() {
 	return quit_callback;
 }
+decltype(display_wrapper_t::presented_callback) &
+display_wrapper_t::on_presented() {
+	return presented_callback;
+}
+decltype(display_wrapper_t::discarded_callback) &
+display_wrapper_t::on_discarded() {
+	return discarded_callback;
+}
+decltype(display_wrapper_t::finish_callback) &
+display_wrapper_t::on_finish() {
+	return finish_callback;
+}
 decltype(display_wrapper_t::pointer_enter_callback) &
 display_wrapper_t::on_pointer_enter() {
 	return pointer_enter_callback;
@@ -482,6 +520,10 @@ int display_wrapper_t::get_height() {
 	return height;
 }
 
+bool display_wrapper_t::has_presentation() {
+	return static_cast<bool>(tracker);
+}
+
 
 
 
@@ -27,6 +27,7 @@
 #ifndef __WRAPPER_HPP_
 #define __WRAPPER_HPP_
 
+#include <cstdint>
 #include <thread>
 #include <future>
 #include <unordered_map>
@@ -77,6 +78,9 @@ private:
 	//callback_t quit_callback;
 	function<void()> frame_callback;
 	function<void()> quit_callback;
+	function<void(uint64_t,uint32_t,uint64_t,uint32_t)> presented_callback;
+	function<void()> discarded_callback;
+	function<void()> finish_callback;
 	function<void(int32_t,int32_t)> pointer_enter_callback;
 	function<void(uint32_t,int32_t,int32_t)> pointer_motion_callback;
 	function<void(uint32_t,uint32_t,uint32_t,
@@ -109,6 +113,11 @@ public:
 
 	decltype(frame_callback) &on_frame();
 	decltype(quit_callback) &on_quit();
+	// a frame reached the parent's screen: CLOCK_MONOTONIC ns, refresh ns, seq, flags
+	decltype(presented_callback) &on_presented();
+	decltype(discarded_callback) &on_discarded();
+	// the event loop ended, the GL context is still current
+	decltype(finish_callback) &on_finish();
 	decltype(pointer_enter_callback) &on_pointer_enter();
 	decltype(pointer_motion_callback) &on_pointer_motion();
 	decltype(pointer_button_callback) &on_pointer_button();
@@ -121,6 +130,9 @@ public:
 	int get_width();
 	int get_height();
 
+	// whether the parent compositor reports presentation times
+	bool has_presentation();
+
 
 	gl_shader *get_shader();
 };
@@ -91,9 +91,15 @@ class proxy_t : public detail::object_t {
 		std::shared_ptr<events_base_t> events;
 		int destroy_opcode;
 		unsigned int counter;
+		interface_id_t class_id; // 0 until first queried
+		uint32_t version; // 0 until first queried
 
 		proxy_data_t();
 		proxy_data_t(std::shared_ptr<events_base_t> ev, int desop, unsigned int cnt);
+
+		// recycled through a detail::block_pool_t
+		static proxy_data_t *create();
+		static void release(proxy_data_t *data);
 	};
 	typedef int(*dispatcher_func)(int, std::vector<detail::any>, std::shared_ptr<proxy_t::events_base_t>);
 
@@ -181,6 +187,29 @@ class proxy_t : public detail::object_t {
 	*/
 	std::string get_class();
 
+	/** \brief Get the interface name (class) of a proxy object.
+	    \return The interface name, valid as long as the proxy exists
+
+	    Unlike get_class(), this does not allocate.
+	*/
+	const char *get_class_name();
+
+	/** \brief Get the interface ID of a proxy object.
+	    \return The interface_id_t of the object associated with the proxy
+
+	    The ID is computed once per object and can be compared
+	    against the interface_id member of the generated classes.
+	*/
+	interface_id_t get_class_id();
+
+	/** \brief Get the interface version of a proxy object.
+	    \return The version the object was bound or created with
+
+	    The version is queried once per object, so the generated
+	    request methods can check it cheaply.
+	*/
+	uint32_t get_version();
+
 	/** \brief Assign a proxy to an event queue.
 	    \param queue The event queue that will handle this proxy
 
@@ -204,9 +233,9 @@ class proxy_t : public detail::object_t {
 
 	// marshal request
 	proxy_t marshal_single(uint32_t opcode, const wl_interface *interface,
-	                       std::vector<detail::argument_t> v);
+	                       std::vector<detail::argument_t> v, uint32_t version = 0);
 	proxy_t marshal_single(uint32_t opcode, const wl_interface *interface,
-	                       std::list<detail::argument_t> v);
+	                       std::list<detail::argument_t> v, uint32_t version = 0);
 
   protected:
 	// marshal a request, that doesn't lead a new proxy
@@ -234,13 +263,24 @@ class proxy_t : public detail::object_t {
 	// 	return proxy_t();
 	// }
 
-	// marshal a request, that leads a new proxy
+	// marshal a request, that leads a new proxy of the same version
 	template <typename...T>
 	proxy_t marshal_constructor(uint32_t opcode, const wl_interface *interface,
 	                            T...args) {
 		std::vector<detail::argument_t> v = { detail::argument_t(args)... };
 		if (c_ptr())
-			return marshal_single(opcode, interface, v);
+			return marshal_single(opcode, interface, v, get_version());
+		return proxy_t();
+	}
+
+	// marshal a request, that leads a new proxy of the given version
+	// (wl_registry.bind)
+	template <typename...T>
+	proxy_t marshal_constructor_versioned(uint32_t opcode, const wl_interface *interface,
+	                                      uint32_t version, T...args) {
+		std::vector<detail::argument_t> v = { detail::argument_t(args)... };
+		if (c_ptr())
+			return marshal_single(opcode, interface, v, version);
 		return proxy_t();
 	}
 
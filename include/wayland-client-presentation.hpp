@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_CLIENT_PRESENTATION_HPP
+#define WAYLAND_CLIENT_PRESENTATION_HPP
+
+/** \file */
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <wayland-client.hpp>
+#include <presentation_time-client-protocol.hpp>
+
+namespace wayland {
+
+/** \brief Requests presentation feedback for each commit of a surface
+
+    Frame callbacks tell when to draw the next frame, wp_presentation
+    tells when the last one actually reached the screen, with
+    nanosecond timestamps, the refresh interval and the refresh
+    counter. Video and game clients use it to avoid judder and to
+    measure latency.
+
+    Given a frame_scheduler_t, the tracker requests feedback together
+    with every frame callback and reports the presentation times back
+    to the scheduler, as long as the compositor uses CLOCK_MONOTONIC.
+    Without a scheduler, call request() before each commit.
+
+    Create the tracker right after binding wp_presentation, the
+    clock_id event is sent once after the bind.
+
+    \code{.cpp}
+    frame_scheduler_t frames(surface);
+    presentation_tracker_t tracker(presentation, surface, &frames);
+    tracker.on_presented() = [&](uint64_t time, uint32_t refresh, uint64_t seq,
+                                 wp_presentation_feedback_kind flags) {
+        av_sync(time);
+    };
+    \endcode
+*/
+class presentation_tracker_t {
+private:
+	wp_presentation_proxy_t presentation;
+	surface_proxy_t surface;
+	frame_scheduler_t *frames;
+	uint32_t clock;
+	bool have_clock;
+	// feedback of commits not presented or discarded yet
+	std::list<wp_presentation_feedback_proxy_t> in_flight;
+
+	std::function<void(uint64_t, uint32_t, uint64_t, wp_presentation_feedback_kind)> presented_handler;
+	std::function<void()> discarded_handler;
+
+	void presented(std::list<wp_presentation_feedback_proxy_t>::iterator it,
+	               uint64_t time, uint32_t refresh, uint64_t seq,
+	               wp_presentation_feedback_kind flags);
+
+public:
+	/** \brief Create a tracker
+	    \param presentation The bound wp_presentation global
+	    \param surface The surface whose commits are tracked
+	    \param frames Scheduler to request feedback with and to report
+	                  presentation times to, or NULL
+	*/
+	presentation_tracker_t(wp_presentation_proxy_t presentation,
+	                       surface_proxy_t surface,
+	                       frame_scheduler_t *frames = NULL);
+	~presentation_tracker_t();
+
+	presentation_tracker_t(const presentation_tracker_t &) = delete;
+	presentation_tracker_t &operator=(const presentation_tracker_t &) = delete;
+
+	/** \brief Request feedback for the next commit of the surface
+	    Done by the scheduler, if there is one.
+	*/
+	void request();
+
+	/** \brief Called when a commit was shown
+	    The arguments are the time in nanoseconds of the presentation
+	    clock, the nanoseconds until the next refresh or 0, the refresh
+	    counter or 0, and how the frame was presented.
+	*/
+	std::function<void(uint64_t, uint32_t, uint64_t, wp_presentation_feedback_kind)> &on_presented();
+
+	/** \brief Called when a commit was never shown
+	*/
+	std::function<void()> &on_discarded();
+
+	/** \brief Clock of the presentation times
+	    \return The clockid_t, valid once has_clock() is true
+	*/
+	uint32_t get_clock();
+	bool has_clock();
+
+	/** \brief Number of commits still waiting for feedback
+	*/
+	unsigned int get_pending_count();
+};
+
+}
+
+#endif
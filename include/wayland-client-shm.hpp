@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_CLIENT_SHM_HPP
+#define WAYLAND_CLIENT_SHM_HPP
+
+/** \file */
+
+#include <cstdint>
+#include <list>
+#include <wayland-client.hpp>
+
+namespace wayland {
+
+namespace detail {
+// memfd sealed against shrinking, or an unlinked shm_open object,
+// of the given size; throws std::runtime_error on failure
+int create_anonymous_file(int32_t size);
+}
+
+class shm_buffer_pool_t;
+
+/** \brief A buffer handed out by shm_buffer_pool_t.
+
+    The buffer is busy from shm_buffer_pool_t::acquire() until the
+    compositor releases it, after which the pool hands it out again.
+    A default constructed or failed handle converts to false.
+    Handles are cheap to copy; do not keep them past the frame they
+    were acquired for, and don't keep copies of the wl_buffer proxy
+    either, the pool destroys buffers it no longer needs.
+*/
+class shm_pool_buffer_t {
+private:
+	struct slot_t {
+		buffer_proxy_t buffer;
+		int32_t offset;
+		int32_t size;
+		int32_t width, height, stride;
+		shm_format format;
+		bool busy;
+	};
+
+	shm_buffer_pool_t *pool;
+	slot_t *slot;
+
+	shm_pool_buffer_t(shm_buffer_pool_t *p, slot_t *s);
+
+	friend class shm_buffer_pool_t;
+
+public:
+	shm_pool_buffer_t();
+
+	operator bool() const;
+
+	/** \brief The wl_buffer to attach to a surface
+	*/
+	buffer_proxy_t &get_buffer();
+
+	/** \brief Pointer to the pixel data
+	    \return The mapping of the buffer, valid until the pool grows
+	*/
+	void *get_data();
+
+	int32_t get_width();
+	int32_t get_height();
+	int32_t get_stride();
+	shm_format get_format();
+};
+
+/** \brief Allocates wl_buffers from a single growing SHM pool.
+
+    The pool is backed by a sealed memfd that is mapped once. Buffers
+    are sub-allocated from it and recycled when the compositor sends
+    wl_buffer.release, so steady state rendering neither maps memory
+    nor creates protocol objects. When the pool runs out of space it
+    grows with wl_shm_pool.resize; since the mapping may move, data
+    pointers have to be fetched again after each acquire().
+
+    At most get_max_buffers() buffers of the same size and format
+    exist at a time, which bounds the pool to N-buffering. Released
+    buffers of another size or format are destroyed by the next
+    acquire(), e.g. after a window resize, and their memory is
+    reused.
+
+    \code{.cpp}
+    shm_buffer_pool_t pool(shm);
+    ...
+    shm_pool_buffer_t buf = pool.acquire(width, height, width * 4, shm_format::argb8888);
+    if(!buf)
+        return; // all buffers busy, try again on the next release
+    paint(buf.get_data());
+    surface.attach(buf.get_buffer(), 0, 0);
+    surface.commit();
+    \endcode
+*/
+class shm_buffer_pool_t {
+private:
+	// free byte range of the pool
+	struct range_t {
+		int32_t offset;
+		int32_t size;
+	};
+
+	shm_pool_proxy_t pool;
+	int fd;
+	uint8_t *data;
+	int32_t size;
+	unsigned int max_buffers;
+	std::list<shm_pool_buffer_t::slot_t> slots;
+	std::list<range_t> free_ranges;
+
+	void grow(int32_t needed);
+	bool allocate_range(int32_t needed, int32_t &offset);
+	void free_range(int32_t offset, int32_t len);
+	void destroy_slot(std::list<shm_pool_buffer_t::slot_t>::iterator it);
+	void release(shm_pool_buffer_t::slot_t *slot);
+
+	friend class shm_pool_buffer_t;
+
+public:
+	/** \brief Create a pool
+	    \param shm The wl_shm global
+	    \param initial_size Bytes to allocate up front
+	    \param max_buffers Buffers per size and format, 2 or more
+
+	    Throws std::runtime_error if the memory can't be allocated.
+	*/
+	shm_buffer_pool_t(shm_proxy_t &shm, int32_t initial_size = 0,
+	                  unsigned int max_buffers = 3);
+	~shm_buffer_pool_t();
+
+	shm_buffer_pool_t(const shm_buffer_pool_t &) = delete;
+	shm_buffer_pool_t &operator=(const shm_buffer_pool_t &) = delete;
+
+	/** \brief Get a buffer that is not in use by the compositor
+	    \param width Width in pixels
+	    \param height Height in pixels
+	    \param stride Bytes per row
+	    \param format Pixel format
+	    \return A buffer, or a handle converting to false if all
+	            get_max_buffers() buffers of this kind are busy
+
+	    Never blocks. A free buffer of the same size and format is
+	    reused, otherwise a new one is created, growing the pool if
+	    needed. Throws std::invalid_argument if stride is too small
+	    for width pixels of format.
+	*/
+	shm_pool_buffer_t acquire(int32_t width, int32_t height,
+	                          int32_t stride, shm_format format);
+
+	unsigned int get_max_buffers();
+
+	/** \brief Number of buffers not yet released by the compositor
+	*/
+	unsigned int get_busy_count();
+
+	/** \brief Current size of the pool in bytes
+	*/
+	int32_t get_size();
+};
+
+}
+
+#endif
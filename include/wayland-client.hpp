@@ -28,6 +28,9 @@
 
 /** \file */
 
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
 #include <memory>
 #include <string>
 #include <vector>
@@ -398,6 +401,246 @@ class display_client_t : public display_proxy_t {
 	// */
 	// registry_t get_registry();
 };
+
+/** \brief Binds a fixed set of globals with a single roundtrip.
+
+    A registry_binder_t is constructed from a table describing the
+    globals a client needs: the proxy that receives the bound object
+    and the range of interface versions the client implements. The
+    interface name is taken from the target proxy.
+
+    \code{.cpp}
+    registry_binder_t binder({
+        { compositor, 1, 4 },
+        { shell, 1, 1 },
+        { seat, 1, 5 },
+        { shm, 1, 1 },
+        { output, 2, 3, false }, // optional
+    });
+    if(!binder.bind(display, registry))
+        for(auto &name : binder.get_missing())
+            std::cerr << "missing global " << name << std::endl;
+    \endcode
+
+    Advertised globals are looked up in a perfect hash table built
+    from the entries, so each global event costs one hash and at most
+    one string comparison regardless of the number of entries. Binds
+    are issued directly from the global events, and bind() returns
+    after a single roundtrip. Globals advertised with a version below
+    the minimum are treated as missing. Only the first matching global
+    of each interface is bound.
+
+    The table is built by the constructor, because the set of globals
+    is only known from the entries: targets are passed as proxy_t
+    references, so their interface names are run-time values. Building
+    it at compile time from the interface_name constants would need the
+    target types as template arguments. The seed search costs a few
+    hashes per entry and runs once per binder, which is small compared
+    to the roundtrip bind() waits for.
+*/
+class registry_binder_t {
+  public:
+	struct entry_t {
+		proxy_t *target;
+		uint32_t min_version;
+		uint32_t max_version;
+		bool required;
+
+		entry_t(proxy_t &target, uint32_t min_version = 1,
+		        uint32_t max_version = UINT32_MAX, bool required = true);
+	};
+
+  private:
+	struct slot_t {
+		entry_t entry;
+		std::string interface;
+		bool bound;
+	};
+
+	std::vector<slot_t> slots;
+	std::vector<int> table;
+	uint32_t seed;
+	std::vector<std::string> missing;
+
+	static uint32_t hash(const char *s, uint32_t seed);
+	int lookup(const std::string &interface);
+	void global(registry_proxy_t &registry, uint32_t name,
+	            const std::string &interface, uint32_t version);
+
+  public:
+	/** \brief Build the lookup table for a set of globals
+	    \param entries The globals to bind
+
+	    Throws std::invalid_argument if an interface appears twice.
+	*/
+	registry_binder_t(std::initializer_list<entry_t> entries);
+
+	/** \brief Bind all globals of the table
+	    \param display The display to roundtrip on
+	    \param registry Receives the registry object
+	    \return true, if every required global was bound
+
+	    Creates the registry, binds each matching global at the highest
+	    version supported by both sides and blocks for one roundtrip.
+	    The global handler of the registry is reset afterwards, so
+	    the binder may go out of scope once bind() returns.
+	*/
+	bool bind(display_client_t &display, registry_proxy_t &registry);
+
+	/** \brief Interface names of required globals that were not bound
+	    \return The list of missing interfaces after bind()
+	*/
+	const std::vector<std::string> &get_missing();
+
+	/** \brief Check whether a particular target was bound
+	    \param target A proxy passed as target of an entry
+	    \return true, if a global was bound to target
+	*/
+	bool is_bound(const proxy_t &target);
+};
+
+/** \brief Paces redraws of a surface with frame callbacks
+
+    Clients call schedule() whenever their content changed and draw in
+    the on_redraw() handler. The scheduler requests the frame callback
+    of the next commit before calling the handler, so at most one
+    frame is in flight. A redraw only happens when something was
+    scheduled. Without changes the surface stays idle.
+
+    The timestamps of the done events give an estimate of the refresh
+    interval. The handler gets the predicted presentation time of the
+    frame it draws, in the same clock, which suits animations.
+
+    With set_late_start(), redraws are delayed after a done event
+    until just before the predicted deadline. The scheduler tracks how
+    long a redraw takes and starts it as late as possible, so input
+    read in the handler is as fresh as possible. The delay runs on a
+    timerfd: add get_fd() to the poll set and call dispatch() when it
+    is readable.
+
+    Frame callbacks only carry milliseconds. If the compositor supports
+    wp_presentation, feed the presented events to presented(), e.g.
+    with presentation_tracker_t from wayland-client-presentation.hpp.
+    The refresh interval and deadlines then follow the actual
+    presentation times in nanoseconds.
+
+    \code{.cpp}
+    frame_scheduler_t frames(surface);
+    frames.on_redraw() = [&](uint32_t time) {
+        render(time);
+        surface.attach(buffer, 0, 0);
+        surface.damage(0, 0, width, height);
+        surface.commit();
+    };
+    frames.schedule();
+    \endcode
+*/
+class frame_scheduler_t {
+  private:
+	surface_proxy_t surface;
+	callback_proxy_t frame_cb;
+	std::function<void(uint32_t)> redraw_handler;
+	std::function<void()> frame_request_handler;
+
+	bool pending;
+	bool dirty;
+	bool late_start;
+	bool timer_armed;
+	bool back_to_back;
+	int timer_fd;
+
+	// timestamp of the last done event, in milliseconds
+	uint32_t last_done;
+	bool have_done;
+	// last presentation, CLOCK_MONOTONIC nanoseconds
+	uint64_t last_presented;
+	bool have_presented;
+	// the compositor reported the refresh interval
+	bool refresh_known;
+	// estimates, in microseconds
+	uint64_t interval;
+	uint64_t render_time;
+	uint64_t margin;
+
+	void done(uint32_t time);
+	void redraw(bool continued);
+
+	frame_scheduler_t(const frame_scheduler_t &);
+	frame_scheduler_t &operator=(const frame_scheduler_t &);
+
+  public:
+	/** \brief Create a scheduler
+	    \param surface The surface whose commits are paced
+	*/
+	frame_scheduler_t(surface_proxy_t surface);
+	~frame_scheduler_t();
+
+	/** \brief Request a redraw
+	    Draws right away if no frame is in flight, otherwise after the
+	    frame callback of the last one.
+	*/
+	void schedule();
+
+	/** \brief Called to draw a frame
+	    The argument is the predicted presentation time in milliseconds,
+	    in the clock of the frame callbacks. The handler must commit the
+	    surface.
+	*/
+	std::function<void(uint32_t)> &on_redraw();
+
+	/** \brief Called whenever a frame callback is requested
+	    Runs right before the redraw handler, to request more state of
+	    the same commit, like presentation feedback.
+	*/
+	std::function<void()> &on_frame_request();
+
+	/** \brief Report when a frame was presented
+	    \param time CLOCK_MONOTONIC nanoseconds of the presentation
+	    \param refresh Nanoseconds until the next refresh, 0 if unknown
+
+	    A non-zero refresh replaces the estimate from the frame
+	    callbacks, late starts aim at the next refresh after time.
+	*/
+	void presented(uint64_t time, uint32_t refresh);
+
+	/** \brief Delay redraws until shortly before the deadline
+	    \param enable Whether to start redraws late
+	    \param safety_margin Microseconds to keep free before the
+	    predicted deadline
+	*/
+	void set_late_start(bool enable, uint32_t safety_margin = 4000);
+
+	/** \brief File descriptor of the late start timer
+	    \return A timerfd, readable when a delayed redraw is due
+	*/
+	int get_fd();
+
+	/** \brief Run a delayed redraw
+	    Call when get_fd() is readable.
+	*/
+	void dispatch();
+
+	/** \brief Check whether a frame was committed but not shown yet
+	    \return true, while the frame callback is outstanding
+	*/
+	bool is_pending();
+
+	/** \brief Estimated refresh interval
+	    \return Microseconds between frame callbacks, at full rate
+	*/
+	uint32_t get_refresh_interval();
+
+	/** \brief Predicted time of the next frame
+	    \return Milliseconds, in the clock of the frame callbacks
+	*/
+	uint32_t predict_next_frame();
+
+	/** \brief Predicted time of the next presentation
+	    \return CLOCK_MONOTONIC nanoseconds, 0 before anything was
+	            reported to presented()
+	*/
+	uint64_t predict_next_presentation();
+};
 }
 
 #endif
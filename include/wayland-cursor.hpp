@@ -26,17 +26,30 @@
 #ifndef CURSOR_HPP
 #define CURSOR_HPP
 
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <wayland-cursor.h>
 #include <wayland-client-protocol.hpp>
 
 namespace wayland {
 class cursor_image_t {
   private:
-	wl_cursor_image *cursor_image;
-	cursor_image_t(wl_cursor_image *image);
+	struct image_data_t {
+		uint32_t width, height;
+		uint32_t hotspot_x, hotspot_y;
+		uint32_t delay;
+		buffer_proxy_t buffer;
+		// keeps a libwayland-cursor theme alive for its buffers
+		std::shared_ptr<wl_cursor_theme> owner;
+	};
+
+	std::shared_ptr<image_data_t> data;
+	cursor_image_t(std::shared_ptr<image_data_t> d);
 	friend class cursor_t;
+	friend class cursor_theme_t;
 
   public:
 	cursor_image_t();
@@ -50,8 +63,14 @@ class cursor_image_t {
 
 class cursor_t {
   private:
-	wl_cursor *cursor;
-	cursor_t(wl_cursor *c);
+	struct cursor_data_t {
+		std::string name;
+		std::vector<cursor_image_t> images;
+		uint32_t total_delay;
+	};
+
+	std::shared_ptr<cursor_data_t> data;
+	cursor_t(std::shared_ptr<cursor_data_t> d);
 	friend class cursor_theme_t;
 
   public:
@@ -60,22 +79,175 @@ class cursor_t {
 	std::string name();
 	cursor_image_t image(unsigned int n);
 	int frame(uint32_t time);
+
+	/** \brief Find the frame to show at a point in time
+	    \param time Milliseconds since the animation started
+	    \param duration Set to the milliseconds the frame stays visible,
+	    0 for the last frame of a static cursor
+	    \return Index of the frame
+	*/
+	int frame_and_duration(uint32_t time, uint32_t &duration);
 };
 
+/** \brief A cursor theme
+
+    Cursors are loaded on demand. The first get_cursor() indexes the
+    cursor directories of the theme and the themes it inherits from,
+    without reading any cursor files. Each requested cursor is then
+    decoded from its Xcursor file at the size closest to the one asked
+    for, and its images are copied into one SHM pool shared by the
+    whole theme.
+
+    Unknown names are looked up through the usual alias chains, e.g.
+    "left_ptr", "default" and "arrow". If no file is found at all, the
+    theme falls back to wl_cursor_theme_load(), which also provides
+    libwayland-cursor's built-in cursors.
+*/
 class cursor_theme_t {
   private:
-	struct cursor_theme_ptr {
-		wl_cursor_theme *cursor_theme;
-		~cursor_theme_ptr();
-	};
+	struct theme_data_t;
+	std::shared_ptr<theme_data_t> theme;
 
-	std::shared_ptr<cursor_theme_ptr> cursor_theme;
+	void build_index();
+	cursor_t load_file(const std::string &name, const std::string &path);
+	cursor_t load_fallback(const std::string &name);
 
   public:
 	cursor_theme_t();
+
+	/** \brief Create a cursor theme
+	    \param name Name of the theme, "" for the default theme
+	    \param size Nominal cursor size in pixels
+	    \param shm The wl_shm global, used for the cursor buffers
+	*/
 	cursor_theme_t(std::string name, int size, shm_proxy_t shm);
+
+	/** \brief Get a cursor, loading it on first use
+	    \param name Name of the cursor
+	    \return The cursor
+
+	    Throws std::runtime_error if neither the name nor any of its
+	    aliases exist in the theme.
+	*/
 	cursor_t get_cursor(std::string name);
 };
+
+/** \brief Sets and animates the cursor of a pointer
+
+    The manager loads a theme once per buffer scale and keeps the
+    wl_buffers of every cursor it was asked for, so switching between
+    cursors never touches the theme again. Animated cursors are driven
+    by a timerfd: add get_fd() to the client's poll set and call
+    dispatch() when it becomes readable.
+
+    The cursor surface is only attached and committed when the shown
+    frame changes. Setting the cursor that is already shown, e.g. on
+    every wl_pointer.enter, just sends wl_pointer.set_cursor with the
+    new serial.
+
+    \code{.cpp}
+    cursor_manager_t cursors(compositor, shm, "default", 24);
+    pointer.on_enter() = [&](uint32_t serial, surface_proxy_t, fixed_t, fixed_t) {
+        cursors.set_cursor(pointer, serial, "left_ptr");
+    };
+    \endcode
+*/
+class cursor_manager_t {
+  private:
+	struct frame_t {
+		buffer_proxy_t buffer;
+		int32_t width, height;
+		int32_t hotspot_x, hotspot_y;
+	};
+
+	struct cursor_entry_t {
+		std::string name;
+		cursor_t cursor;
+		std::vector<frame_t> frames;
+	};
+
+	struct theme_entry_t {
+		cursor_theme_t theme;
+		std::unordered_map<std::string, std::shared_ptr<cursor_entry_t>> cursors;
+	};
+
+	shm_proxy_t shm;
+	std::string theme_name;
+	int size;
+	int scale;
+	std::map<int, theme_entry_t> themes;
+
+	surface_proxy_t surface;
+	pointer_proxy_t pointer;
+	bool has_pointer;
+	uint32_t serial;
+	bool hidden;
+
+	std::shared_ptr<cursor_entry_t> current;
+	int current_frame;
+	int32_t hotspot_x, hotspot_y;
+	uint64_t anim_start;
+	int timer_fd;
+
+	std::shared_ptr<cursor_entry_t> load(const std::string &name);
+	void show_frame(unsigned int n);
+	void update();
+	void arm_timer(uint32_t ms);
+
+	cursor_manager_t(const cursor_manager_t &);
+	cursor_manager_t &operator=(const cursor_manager_t &);
+
+  public:
+	/** \brief Create a cursor manager
+	    \param compositor Used to create the cursor surface
+	    \param shm Used to load the themes
+	    \param theme Name of the theme, "" for the default theme
+	    \param size Cursor size at scale 1
+	*/
+	cursor_manager_t(compositor_proxy_t compositor, shm_proxy_t shm,
+	                 std::string theme = "", int size = 24);
+	~cursor_manager_t();
+
+	/** \brief Load a cursor ahead of time
+	    \param name Name of the cursor
+	    \return false, if the theme has no cursor with that name
+	*/
+	bool preload(std::string name);
+
+	/** \brief Set the buffer scale of the cursor
+	    \param s Integer scale of the output the pointer is on
+
+	    The theme is loaded at size * s on first use. The cursor
+	    surface needs wl_compositor version 3 for scales other than 1.
+	*/
+	void set_scale(int s);
+
+	/** \brief Show a cursor
+	    \param p The pointer
+	    \param serial Serial of the last wl_pointer.enter event
+	    \param name Name of the cursor
+
+	    Throws std::runtime_error if the theme has no such cursor.
+	*/
+	void set_cursor(pointer_proxy_t p, uint32_t serial, std::string name);
+
+	/** \brief Hide the cursor
+	    \param p The pointer
+	    \param serial Serial of the last wl_pointer.enter event
+	*/
+	void hide(pointer_proxy_t p, uint32_t serial);
+
+	/** \brief File descriptor of the animation timer
+	    \return A timerfd, readable when the next frame is due
+	*/
+	int get_fd();
+
+	/** \brief Advance the animation
+	    Call when get_fd() is readable. Commits the cursor surface only
+	    if the frame changed.
+	*/
+	void dispatch();
+};
 }
 
 #endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_EGL_SURFACE_HPP
+#define WAYLAND_EGL_SURFACE_HPP
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <wayland-client.hpp>
+#include <wayland-egl.hpp>
+
+namespace wayland {
+/** \brief Rectangle in surface coordinates, origin at the top left
+*/
+struct egl_rect_t {
+	int32_t x, y;
+	int32_t width, height;
+};
+
+/** \brief EGL window surface with partial repaints and frame pacing
+
+    Owns an egl_window_t and the EGLSurface created on it. Each swap
+    carries the damaged rectangles of the frame. With
+    EGL_KHR_swap_buffers_with_damage or EGL_EXT_swap_buffers_with_damage
+    only those reach the compositor; without them the whole surface is
+    damaged.
+
+    With EGL_EXT_buffer_age, get_repaint_region() adds the damage of
+    the frames swapped since the back buffer was last drawn to. So
+    clients only repaint what changed and keep the rest of the buffer.
+    Without buffer age, or for buffers older than the damage history,
+    the whole surface is repainted.
+
+    The swap interval is set to 0, so eglSwapBuffers never blocks on
+    the compositor. Pacing comes from frame callbacks instead: every
+    swap requests one, and clients should only draw again once
+    on_frame() was called.
+
+    \code{.cpp}
+    egl_surface_t egl(egldisplay, config, surface, 640, 480);
+    egl.make_current(eglcontext);
+    egl.on_frame() = [&](uint32_t) {
+        if(!damage.empty())
+            draw();
+    };
+
+    void draw() {
+        for(auto &r : egl.get_repaint_region(damage))
+            repaint(r);
+        egl.swap_buffers(damage);
+        damage.clear();
+    }
+    \endcode
+*/
+class egl_surface_t {
+  private:
+	typedef EGLBoolean (EGLAPIENTRY *swap_with_damage_t)(EGLDisplay, EGLSurface, EGLint *, EGLint);
+
+	EGLDisplay display;
+	EGLSurface egl_surface;
+	egl_window_t window;
+	surface_proxy_t surface;
+	callback_proxy_t frame_cb;
+	int width, height;
+
+	bool has_buffer_age;
+	swap_with_damage_t swap_with_damage;
+
+	// damage of the last swaps, most recent first
+	std::deque<std::vector<egl_rect_t> > history;
+	bool frame_pending;
+	std::function<void(uint32_t)> frame_handler;
+
+	egl_surface_t(const egl_surface_t &);
+	egl_surface_t &operator=(const egl_surface_t &);
+
+  public:
+	/** \brief Create the window and its EGL surface
+	    \param display An initialized EGL display
+	    \param config Config with EGL_WINDOW_BIT
+	    \param surface The Wayland surface to render to
+	    \param width Width of the EGL buffer
+	    \param height Height of the EGL buffer
+
+	    Throws std::runtime_error if the surface can't be created.
+	*/
+	egl_surface_t(EGLDisplay display, EGLConfig config,
+	              surface_proxy_t &surface, int width, int height);
+	~egl_surface_t();
+
+	/** \brief Make the surface current and turn off swap throttling
+	    \param context Context to bind
+	*/
+	void make_current(EGLContext context);
+
+	/** \brief Resize the EGL buffers
+	    Forgets the damage history, the next frame is repainted fully.
+	*/
+	void resize(int width, int height);
+
+	int get_width();
+	int get_height();
+
+	/** \brief Age of the back buffer
+	    \return Frames since the back buffer was last drawn, 0 if unknown
+	*/
+	int get_buffer_age();
+
+	/** \brief Region to repaint in the next frame
+	    \param damage What changed since the last swap
+	    \return damage, plus whatever changed since the back buffer
+	    was last drawn to; the whole surface if that is unknown
+	*/
+	std::vector<egl_rect_t> get_repaint_region(const std::vector<egl_rect_t> &damage);
+
+	/** \brief Swap buffers and send only the damaged parts
+	    \param damage What changed since the last swap, empty for
+	    the whole surface
+
+	    Requests a frame callback before swapping. Throws
+	    std::runtime_error if swapping fails.
+	*/
+	void swap_buffers(const std::vector<egl_rect_t> &damage);
+
+	/** \brief Check whether the last frame was not displayed yet
+	    \return true, until the frame callback of the last swap fired
+	*/
+	bool is_frame_pending();
+
+	/** \brief Called when the compositor is ready for a new frame
+	    The argument is the timestamp of the frame callback.
+	*/
+	std::function<void(uint32_t)> &on_frame();
+};
+}
+
+#endif
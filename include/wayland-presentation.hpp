@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_PRESENTATION_HPP
+#define WAYLAND_PRESENTATION_HPP
+
+#include <time.h>
+#include <functional>
+#include <list>
+#include <vector>
+#include <wayland-server-core.hpp>
+#include <wayland-server-protocol.hpp>
+#include <presentation_time-server-protocol.hpp>
+
+namespace wayland {
+
+/** \brief The wp_presentation global
+
+    Tells clients the clock of the presentation times and hands every
+    feedback request to the on_feedback() handler. The compositor keeps
+    the feedback with the pending state of the surface, exactly like
+    frame callbacks, and completes it with a presentation_feedback_list_t
+    once the committed content was shown or replaced.
+*/
+class presentation_t : public global_t {
+private:
+	clockid_t clock;
+	std::list<wp_presentation_resource_t> resources;
+	std::function<void(surface_resource_t, wp_presentation_feedback_resource_t)> feedback_handler;
+
+public:
+	/** \brief Create the global
+	    \param display The display to advertise it on
+	    \param clock Clock the compositor takes presentation times from
+	*/
+	presentation_t(display_server_t &display, clockid_t clock = CLOCK_MONOTONIC);
+
+	virtual void bind(resource_t res, void *data);
+
+	clockid_t get_clock();
+
+	/** \brief Called for every feedback request
+	    The feedback belongs to the next commit of the surface. Without
+	    a handler it is discarded right away.
+	*/
+	std::function<void(surface_resource_t, wp_presentation_feedback_resource_t)> &on_feedback();
+};
+
+/** \brief Feedback objects waiting for the same content update
+
+    Surface states keep one for the feedback of their commit. When the
+    compositor composes a frame, it collects the lists of the shown
+    surfaces and completes them after the frame was actually presented,
+    e.g. on the page flip or when the parent compositor reported it.
+    Each feedback object is destroyed after its event, as the protocol
+    requires.
+*/
+class presentation_feedback_list_t {
+private:
+	std::vector<wp_presentation_feedback_resource_t> feedbacks;
+
+public:
+	void add(wp_presentation_feedback_resource_t feedback);
+
+	/** \brief Move all feedback of another list to the end of this one
+	*/
+	void append(presentation_feedback_list_t &other);
+
+	bool empty();
+
+	/** \brief Report that the content was shown
+	    \param time Nanoseconds in the clock of presentation_t
+	    \param refresh Nanoseconds until the next refresh, 0 if unknown
+	                   or the output has no constant refresh rate
+	    \param seq Refresh counter of the output, 0 if there is none
+	    \param flags How the frame was presented
+	    \param outputs Output resources of the output it was shown on,
+	                   sync_output goes to those of the same client
+	*/
+	void presented(uint64_t time, uint32_t refresh, uint64_t seq,
+	               wp_presentation_feedback_kind flags,
+	               const std::vector<output_resource_t> &outputs = std::vector<output_resource_t>());
+
+	/** \brief Report that the content was never shown
+	    For content replaced by a later commit before it was presented.
+	*/
+	void discarded();
+};
+
+}
+
+#endif
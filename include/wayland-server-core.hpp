@@ -32,8 +32,9 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <mutex>
+#include <list>
 #include <functional>
+#include <mutex>
 #include <wayland-server-core.h>
 #include <wayland-util.hpp>
 
@@ -106,6 +107,94 @@ public:
 	
 };
 
+namespace detail {
+/** \brief Per-client memory for resource meta data and request tables
+
+    Small blocks are carved from 4 KiB chunks and recycled through a
+    free list per size class, larger ones go to operator new. All
+    resources of a client share one arena. Its chunks are released
+    together once the client has disconnected and the last block was
+    freed. Resources may be dropped from other threads than the one
+    dispatching the display, e.g. by a render thread completing frame
+    callbacks, so the arena is locked like the client side block_pool_t.
+*/
+class client_arena_t {
+private:
+	static const size_t granule = 16;
+	static const size_t size_classes = 32; // blocks up to 512 bytes
+	static const size_t chunk_size = 4096;
+
+	struct free_block_t {
+		free_block_t *next;
+	};
+
+	// standard layout, so the wl_listener leads back to the arena
+	struct listener_t {
+		wl_listener listener;
+		client_arena_t *arena;
+	};
+
+	std::mutex lock;
+	free_block_t *free_lists[size_classes];
+	std::vector<char*> chunks;
+	char *chunk_pos;
+	char *chunk_end;
+	// the client while it is connected plus one per live block
+	unsigned int refs;
+	listener_t client_destroyed;
+
+	client_arena_t();
+	~client_arena_t();
+	void unref();
+	static void c_client_destroyed(wl_listener *listener, void *data);
+
+public:
+	client_arena_t(const client_arena_t&) = delete;
+	client_arena_t &operator=(const client_arena_t&) = delete;
+
+	/** \brief Get the arena of a client, created on first use
+	    \param client Client to get the arena of
+	*/
+	static client_arena_t *get(wl_client *client);
+
+	void *allocate(size_t size);
+	void deallocate(void *p, size_t size);
+};
+
+/** \brief Allocator handing out memory of a client_arena_t, for allocate_shared
+*/
+template <typename T>
+struct arena_allocator {
+	typedef T value_type;
+	client_arena_t *arena;
+
+	arena_allocator(client_arena_t *a) : arena(a) {
+	}
+
+	template <typename U>
+	arena_allocator(const arena_allocator<U> &other) : arena(other.arena) {
+	}
+
+	T *allocate(size_t n) {
+		return static_cast<T*>(arena->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n) {
+		arena->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const arena_allocator<U> &other) const {
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator!=(const arena_allocator<U> &other) const {
+		return arena != other.arena;
+	}
+};
+}
+
 /** \brief reference to the resource
 
  */
@@ -115,7 +204,10 @@ protected:
 	struct requests_base_t {
 		virtual ~requests_base_t() { }
 	};
-	typedef int(*dispatcher_func)(int, std::vector<detail::any>, std::shared_ptr<resource_t::requests_base_t>);
+	/* Decodes the arguments of one request and calls its handler.
+	   The scanner emits one per request, indexed by opcode. */
+	typedef int(*request_thunk_t)(resource_t &res, requests_base_t *requests,
+	                              const wl_message *message, wl_argument *args);
 
 	//struct user_data_t {
 	//	virtual ~user_data_t() { }
@@ -124,13 +216,24 @@ protected:
 private:
 	struct resource_data_t {
 		std::shared_ptr<requests_base_t> requests;
+		const request_thunk_t *thunks;
 		unsigned int counter;
-		std::mutex lock;
+		interface_id_t class_id; // 0 until first queried
+		uint32_t version; // 0 until first queried
 		//user_data_t *user_data;
 		void *user_data;
+		// set once the wl_resource is gone, remaining copies are inert
+		bool destroyed;
+		std::list<std::function<void()>> destroy_listeners;
+		// where this struct lives, see create() and release()
+		detail::client_arena_t *arena;
 
 		resource_data_t();
 		resource_data_t(std::shared_ptr<requests_base_t> ev, unsigned int cnt);
+
+		// allocated from the arena of the client owning the resource
+		static resource_data_t *create(wl_resource *resource);
+		static void release(resource_data_t *data);
 	};
 
 	// Member vars
@@ -212,6 +315,9 @@ public:
 
 	/** \brief Get the version
 		\return version
+
+		Queried once per resource, so the generated send_* methods
+		can check it cheaply.
 	 */
 	uint32_t get_version();
 
@@ -220,6 +326,21 @@ public:
 	 */
 	std::string get_class();
 
+	/** \brief Get the interface name (class) of a resource object.
+	    \return The interface name, valid as long as the resource exists
+
+	    Unlike get_class(), this does not allocate.
+	 */
+	const char *get_class_name();
+
+	/** \brief Get the interface ID of a resource object.
+	    \return The interface_id_t of the object associated with the resource
+
+	    The ID is computed once per object and can be compared
+	    against the interface_id member of the generated classes.
+	 */
+	interface_id_t get_class_id();
+
 	// /** \brief Assign a resource to an event queue.
 	//     \param queue The event queue that will handle this resource
 
@@ -245,29 +366,79 @@ public:
 
 	void post_error(uint32_t code, const char *msg, ...);
 
+	/** \brief Destroy the resource now.
+
+	    Destroys the underlying wl_resource regardless of how many
+	    copies of this resource_t exist, as done in reply to a
+	    destructor request. The destroy listeners are run, the user
+	    data is reset to NULL and the remaining copies become inert:
+	    events posted to them are dropped. Destroying twice is a no-op.
+	 */
+	void destroy();
+
+	/** \brief Check whether the resource has been destroyed.
+	    \return true, after destroy() or after the client went away
+	 */
+	bool is_destroyed();
+
+	/** \brief Register a function to run when the resource is destroyed.
+	    \param listener Called once, while the wl_resource still exists
+
+	    Listeners run when the resource is destroyed for any reason:
+	    destroy(), the last copy going out of scope, or the client
+	    disconnecting. This is where objects attached through the user
+	    data should be released.
+	 */
+	void add_destroy_listener(std::function<void()> listener);
+
 protected:
 
 	/*
-	  Sets the dispatcher and its user data. User data must be an
+	  Sets the request thunks and their user data. User data must be an
 	  instance of a class derived from requests_base_t, allocated with
-	  new. Will automatically be deleted upon destruction.
+	  new. Will automatically be deleted upon destruction. The thunk
+	  table is indexed by opcode and must outlive the resource.
+	  Passing no requests only installs the thunks, so the requests
+	  can still be set later on.
 	*/
 	void set_requests(std::shared_ptr<requests_base_t> requests,
-	                int(*dispatcher)(int, std::vector<detail::any>, std::shared_ptr<resource_t::requests_base_t>));
+	                  const request_thunk_t *thunks);
 
 	// Retrieve the perviously set user data
 	std::shared_ptr<requests_base_t> get_requests();
 
+	// Allocate a requests_t in the arena of the client
+	template <typename R>
+	std::shared_ptr<requests_base_t> make_requests() {
+		if(display || !data)
+			return std::make_shared<R>();
+		return std::allocate_shared<R>(detail::arena_allocator<R>(data->arena));
+	}
+
+	// Retrieve the thunk table the requests are dispatched with
+	const request_thunk_t *get_request_thunks();
+
 	template <typename...T>
 	void post_event(int opcode, T...args);
 
 	void marshal_vector(int opcode, std::vector<detail::argument_t> args);
 
+	// argument decoding used by the generated request thunks
+	static resource_t arg_object(const wl_argument &arg);
+	static resource_t arg_new_id(resource_t &res, const wl_message *message,
+	                             unsigned int index, const wl_argument &arg);
+	static fixed_t arg_fixed(const wl_argument &arg);
+	static std::string arg_string(const wl_argument &arg);
+	static array_t arg_array(const wl_argument &arg);
+
 private:
 	static int c_dispatcher(const void *implementation, void *target,
 	                        uint32_t opcode, const wl_message *message,
 	                        wl_argument *args);
 	static void c_destroy(wl_resource *resource);
+
+	// drop this reference, destroying the resource with the last one
+	void unref();
 };
 
 
@@ -360,7 +531,7 @@ public:
 template <typename...T>
 void resource_t::post_event(int opcode, T...args) {
 	std::vector<detail::argument_t> v = { detail::argument_t(args)... };
-	if (c_ptr()) {
+	if (!is_destroyed() && c_ptr()) {
 		marshal_vector(opcode, v);
 	}
 }
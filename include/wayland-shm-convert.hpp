@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_SHM_CONVERT_HPP
+#define WAYLAND_SHM_CONVERT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <wayland-server-protocol.hpp>
+
+namespace wayland {
+
+class shm_buffer_t;
+
+/** \brief Rectangle in buffer coordinates
+*/
+struct shm_rect_t {
+	int32_t x, y;
+	int32_t width, height;
+};
+
+/** \brief Converts SHM buffer contents to the renderer's pixel layout.
+
+    The native layout is four bytes per pixel in the memory order
+    R, G, B, A, i.e. what GL_RGBA with GL_UNSIGNED_BYTE expects.
+    Formats without alpha are converted to opaque pixels. YUV formats
+    are interpreted as BT.601 limited range; NV12 buffers carry the
+    interleaved chroma plane right after the luma plane, with the same
+    stride.
+
+    Each format has a row kernel in plain C and, on x86, SSE2 and
+    where useful SSSE3 versions. The fastest one supported by the CPU
+    is picked when the converter is created. Conversions work on
+    rectangles, so only damaged parts of a buffer need to be touched.
+
+    \code{.cpp}
+    shm_converter_t conv(buffer->get_format());
+    conv.convert(*buffer, staging.data() + (y * width + x) * 4, width * 4,
+                 { x, y, w, h });
+    \endcode
+*/
+class shm_converter_t {
+public:
+	// converts width pixels starting at column x of a row
+	typedef void (*row_func_t)(uint8_t *dst, const uint8_t *src,
+			const uint8_t *src_uv, int x, int width);
+
+private:
+	shm_format format;
+	row_func_t row_func;
+	const char *implementation;
+
+public:
+	/** \brief Check whether a format can be converted
+	    \param format A wl_shm format
+	    \return true, if a converter exists for format
+	*/
+	static bool is_supported(shm_format format);
+
+	/** \brief Get all formats that can be converted
+	    \return The supported formats, argb8888 and xrgb8888 first
+	*/
+	static std::vector<shm_format> get_formats();
+
+	/** \brief Create a converter
+	    \param fmt Source format
+
+	    Throws std::invalid_argument if fmt is not supported.
+	*/
+	explicit shm_converter_t(shm_format fmt);
+
+	/** \brief Create a converter with a particular kernel set
+	    \param fmt Source format
+	    \param impl "ssse3", "sse2" or "c"
+
+	    Meant for benchmarks and tests. Throws std::invalid_argument
+	    if fmt is not supported, or impl is not available for fmt on
+	    this CPU.
+	*/
+	shm_converter_t(shm_format fmt, const std::string &impl);
+
+	shm_format get_format();
+
+	/** \brief Check whether the source is already in native layout
+	    \return true, if the buffer data can be used without conversion
+	*/
+	bool is_passthrough();
+
+	/** \brief Name of the selected kernel set
+	    \return "ssse3", "sse2" or "c"
+	*/
+	const char *get_implementation();
+
+	/** \brief Convert a rectangle of raw pixel data
+	    \param dst Destination of the rectangle's top left pixel
+	    \param dst_stride Bytes between destination rows
+	    \param src Start of the source buffer
+	    \param src_stride Bytes between source rows
+	    \param width Width of the source buffer
+	    \param height Height of the source buffer
+	    \param rect Part to convert, clipped to the buffer
+	*/
+	void convert(uint8_t *dst, int dst_stride,
+			const uint8_t *src, int src_stride,
+			int32_t width, int32_t height, shm_rect_t rect);
+
+	/** \brief Convert a rectangle of a SHM buffer
+	    \param buffer The buffer, accessed through shm_buffer_access_t
+	    \param dst Destination of the rectangle's top left pixel
+	    \param dst_stride Bytes between destination rows
+	    \param rect Part to convert, clipped to the buffer
+	*/
+	void convert(shm_buffer_t &buffer, uint8_t *dst, int dst_stride,
+			shm_rect_t rect);
+};
+
+}
+
+#endif
@@ -30,6 +30,8 @@
 #include <memory>
 #include <string>
 #include <list>
+#include <vector>
+#include <signal.h>
 #include <wayland-server-core.hpp>
 #include <wayland-server-protocol.hpp>
 
@@ -37,6 +39,13 @@ namespace wayland {
 
 class shm_pool_t;
 
+/** \brief A buffer created from a shm_pool_t.
+
+    The buffer lives as long as its wl_buffer resource; when the client
+    destroys it or disconnects, the object is deleted and
+    from_resource() returns NULL for any remaining copies of the
+    resource. Each buffer holds an internal reference on its pool.
+*/
 class shm_buffer_t {
 private:
 	//wl_shm_buffer *buffer;
@@ -49,9 +58,15 @@ private:
 	shm_format format;
 	int offset;
 
+	// deleted when the resource is destroyed
+	~shm_buffer_t();
+
 public:
 	shm_buffer_t(shm_pool_t &pl, int off, int w, int h,
 			int s, shm_format fmt);
+	shm_buffer_t(const shm_buffer_t &) = delete;
+	shm_buffer_t &operator=(const shm_buffer_t &) = delete;
+
 	static shm_buffer_t *from_resource(buffer_resource_t res);
 	buffer_resource_t get_resource();
 	void bind(buffer_resource_t res);
@@ -61,11 +76,69 @@ public:
 	int get_width();
 	int get_height();
 
+	/** \brief Take an external reference on the pool of this buffer
+	    \return The pool, to be released with shm_pool_t::unref()
+
+	    The pool, and thus the memory returned by get_data(), stays
+	    valid until the reference is dropped, even after the buffer
+	    and the pool resources are destroyed. Resizes requested by the
+	    client are deferred while external references exist, so the
+	    mapping does not move.
+	*/
+	shm_pool_t *ref_pool();
+
+	/** \brief Mark the start of a CPU access to the buffer data
+
+	    Holds an external reference on the pool until end_access(),
+	    so the data pointer stays valid in between. Calls may nest.
+	    Prefer the scoped shm_buffer_access_t.
+
+	    The access is also protected against the client truncating
+	    the file behind the pool: a SIGBUS on the pool mapping is
+	    caught, the mapping is replaced by zero pages, and the client
+	    gets an invalid_fd error at end_access(). Only one pool per
+	    thread can be accessed at a time.
+	*/
+	void begin_access();
+
+	/** \brief Mark the end of a CPU access started with begin_access()
+	*/
+	void end_access();
+
 	void swap_BR_channels();
 
 	void release();
 };
 
+/** \brief Scoped begin_access()/end_access() pair
+
+    \code{.cpp}
+    {
+        shm_buffer_access_t access(buffer);
+        upload(buffer->get_data());
+    }
+    \endcode
+*/
+class shm_buffer_access_t {
+private:
+	shm_buffer_t *buffer;
+
+public:
+	explicit shm_buffer_access_t(shm_buffer_t *buf);
+	~shm_buffer_access_t();
+	shm_buffer_access_t(const shm_buffer_access_t &) = delete;
+	shm_buffer_access_t &operator=(const shm_buffer_access_t &) = delete;
+};
+
+/** \brief Memory pool shared with a client through wl_shm_pool.
+
+    Pools are reference counted like in libwayland: the wl_shm_pool
+    resource and every buffer hold an internal reference, users of
+    shm_buffer_t::ref_pool() and begin_access() an external one. The
+    mapping is released when both counts drop to zero. A resize is
+    applied immediately if there are no external references, otherwise
+    when the last one is dropped.
+*/
 class shm_pool_t {
 private:
 	//shared_ptr<shm_t> shm;
@@ -76,27 +149,61 @@ private:
 	char *data;
 	int32_t size;
 	int32_t new_size;
+	// formats advertised by the shm_t the pool was created from
+	std::vector<shm_format> formats;
 
-	std::list<shm_resource_t> res_list;
+	// deleted with the last reference
+	~shm_pool_t();
+
+	void finish_resize();
+	void unref(bool external);
+
+	// SIGBUS protection for shm_buffer_t::begin_access()
+	static void sigbus_handler(int signum, siginfo_t *info, void *context);
+	static void init_sigbus_handler();
+
+	friend class shm_buffer_t;
 
 public:
-	shm_pool_t(int32_t size, int fd);
+	/** \brief Map a pool
+	    \param size Size of the pool in bytes
+	    \param fd File descriptor to map, closed by the constructor
+	    \param fmts Formats accepted for buffers of the pool
 
-	void bind(shm_pool_resource_t res);
+	    Throws std::runtime_error if the file cannot be mapped.
+	*/
+	shm_pool_t(int32_t size, int fd, std::vector<shm_format> fmts);
+	shm_pool_t(const shm_pool_t &) = delete;
+	shm_pool_t &operator=(const shm_pool_t &) = delete;
 
-	void finish_resize();
+	void bind(shm_pool_resource_t res);
 
 	void *get_data();
+
+	/** \brief Drop a reference taken with shm_buffer_t::ref_pool()
+	*/
+	void unref();
 };
 
 class shm_t : public global_t {
 private:
 	display_server_t display;
+	// wl_shm resources, removed again when they are destroyed
 	std::list<shm_resource_t> res_list;
+	std::vector<shm_format> formats;
 
 public:
 	shm_t(display_server_t disp);
 
+	/** \brief Advertise an additional buffer format
+	    \param format The format
+
+	    Affects clients binding wl_shm afterwards. Buffers with formats
+	    that were not advertised are rejected with an invalid_format
+	    error.
+	*/
+	void add_format(shm_format format);
+
 	virtual void bind(resource_t res, void *data);
 };
 
@@ -27,7 +27,10 @@
 #define WAYLAND_UTIL_HPP
 
 #include <algorithm>
+#include <cstddef>
+#include <mutex>
 #include <typeinfo>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <list>
@@ -48,6 +51,219 @@ class array_t;
 class fixed_t;
 
 namespace detail {
+// FNV-1a hash of a NUL terminated string, usable in constant expressions
+constexpr uint32_t fnv1a(const char *s, uint32_t h = 2166136261u) {
+	return *s ? fnv1a(s + 1, (h ^ static_cast<uint8_t>(*s)) * 16777619u) : h;
+}
+
+// DRM fourcc code as used for the wl_shm format values
+constexpr uint32_t fourcc(char a, char b, char c, char d) {
+	return static_cast<uint32_t>(static_cast<uint8_t>(a))
+		| static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8
+		| static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16
+		| static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24;
+}
+
+/** \brief Bytes per pixel of a wl_shm format
+    \param format Wire value of the format
+    \return Size of the smallest unit a row of pixels is made of. For the
+    planar YUV formats this is the luma plane.
+
+    Keyed on the wire value so that the client and the server side, which
+    each have their own shm_format enum, share the table.
+*/
+inline int shm_format_bpp(uint32_t format) {
+	switch (format) {
+	case fourcc('C', '8', ' ', ' '):
+	case fourcc('R', 'G', 'B', '8'):
+	case fourcc('B', 'G', 'R', '8'):
+	case fourcc('N', 'V', '1', '2'):
+	case fourcc('N', 'V', '2', '1'):
+	case fourcc('N', 'V', '1', '6'):
+	case fourcc('N', 'V', '6', '1'):
+	case fourcc('Y', 'U', 'V', '9'):
+	case fourcc('Y', 'V', 'U', '9'):
+	case fourcc('Y', 'U', '1', '1'):
+	case fourcc('Y', 'V', '1', '1'):
+	case fourcc('Y', 'U', '1', '2'):
+	case fourcc('Y', 'V', '1', '2'):
+	case fourcc('Y', 'U', '1', '6'):
+	case fourcc('Y', 'V', '1', '6'):
+	case fourcc('Y', 'U', '2', '4'):
+	case fourcc('Y', 'V', '2', '4'):
+		return 1;
+	case fourcc('R', 'G', '2', '4'):
+	case fourcc('B', 'G', '2', '4'):
+		return 3;
+	case 0: // argb8888
+	case 1: // xrgb8888
+	case fourcc('X', 'B', '2', '4'):
+	case fourcc('R', 'X', '2', '4'):
+	case fourcc('B', 'X', '2', '4'):
+	case fourcc('A', 'B', '2', '4'):
+	case fourcc('R', 'A', '2', '4'):
+	case fourcc('B', 'A', '2', '4'):
+	case fourcc('X', 'R', '3', '0'):
+	case fourcc('X', 'B', '3', '0'):
+	case fourcc('R', 'X', '3', '0'):
+	case fourcc('B', 'X', '3', '0'):
+	case fourcc('A', 'R', '3', '0'):
+	case fourcc('A', 'B', '3', '0'):
+	case fourcc('R', 'A', '3', '0'):
+	case fourcc('B', 'A', '3', '0'):
+	case fourcc('A', 'Y', 'U', 'V'):
+		return 4;
+	default:
+		// the 16 bit RGB formats and packed 4:2:2 YUV
+		return 2;
+	}
+}
+
+/** \brief Kind of a message argument on the wire
+
+    The values are the characters libwayland uses in message signatures.
+    An untyped new_id is three arguments: string, uint32 and new_id.
+*/
+enum class arg_kind : char {
+	int32 = 'i',
+	uint32 = 'u',
+	fixed = 'f',
+	string = 's',
+	object = 'o',
+	new_id = 'n',
+	array = 'a',
+	fd = 'h'
+};
+
+// n-th of a list of kinds, for constant expressions
+constexpr arg_kind nth_kind(unsigned int) {
+	return arg_kind::int32; // out of range, callers check the count first
+}
+
+template <typename... K>
+constexpr arg_kind nth_kind(unsigned int n, arg_kind k, K... rest) {
+	return n == 0 ? k : nth_kind(n - 1, rest...);
+}
+
+/** \brief Compile-time description of a request or event
+
+    The scanner emits one per message in the generated classes, e.g.
+    surface_proxy_t::messages::request::attach. Templates can use them
+    to specialize code per message without looking at the signature
+    string at runtime.
+
+    \tparam Opcode Opcode of the message
+    \tparam Since Interface version that introduced the message
+    \tparam Nullable Bit n is set if wire argument n may be null
+    \tparam Kinds Kinds of the wire arguments in order
+*/
+template <uint32_t Opcode, uint32_t Since, uint32_t Nullable, arg_kind... Kinds>
+struct message_t {
+	static constexpr uint32_t opcode = Opcode;
+	static constexpr uint32_t since = Since;
+	static constexpr uint32_t nullable = Nullable;
+	static constexpr unsigned int arg_count = sizeof...(Kinds);
+
+	static constexpr arg_kind kind(unsigned int n) {
+		return nth_kind(n, Kinds...);
+	}
+
+	static constexpr bool is_nullable(unsigned int n) {
+		return (Nullable >> n) & 1;
+	}
+};
+
+/** \brief Free list of memory blocks of one size
+
+    Blocks are taken from the free list and only allocated if it is
+    empty, so objects that are created and destroyed all the time, like
+    frame callbacks, stop allocating once the pool has grown to the
+    largest number alive at the same time. Freed blocks are kept for
+    reuse and never handed back.
+
+    \tparam Size Size of the blocks in bytes
+*/
+template <size_t Size>
+class block_pool_t {
+  private:
+	union block_t {
+		block_t *next;
+		typename std::aligned_storage<Size>::type storage;
+	};
+
+	std::mutex lock;
+	block_t *free_list;
+
+	block_pool_t() : free_list(nullptr) { }
+
+  public:
+	block_pool_t(const block_pool_t&) = delete;
+	block_pool_t &operator=(const block_pool_t&) = delete;
+
+	// never destroyed, objects may be freed during static destruction
+	static block_pool_t &instance() {
+		static block_pool_t *pool = new block_pool_t;
+		return *pool;
+	}
+
+	void *allocate() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if(free_list) {
+				block_t *block = free_list;
+				free_list = block->next;
+				return block;
+			}
+		}
+		return ::operator new(sizeof(block_t));
+	}
+
+	void deallocate(void *p) {
+		block_t *block = static_cast<block_t*>(p);
+		std::lock_guard<std::mutex> guard(lock);
+		block->next = free_list;
+		free_list = block;
+	}
+};
+
+/** \brief Allocator recycling single objects through a block_pool_t
+
+    Meant for std::allocate_shared, which allocates the object and its
+    reference count as one block.
+*/
+template <typename T>
+struct pool_allocator {
+	typedef T value_type;
+
+	pool_allocator() { }
+
+	template <typename U>
+	pool_allocator(const pool_allocator<U>&) { }
+
+	T *allocate(size_t n) {
+		if(n == 1)
+			return static_cast<T*>(block_pool_t<sizeof(T)>::instance().allocate());
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n) {
+		if(n == 1)
+			block_pool_t<sizeof(T)>::instance().deallocate(p);
+		else
+			::operator delete(p);
+	}
+
+	template <typename U>
+	bool operator==(const pool_allocator<U>&) const {
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const pool_allocator<U>&) const {
+		return false;
+	}
+};
+
 class any {
   private:
 	class base {
@@ -220,7 +436,8 @@ class argument_t {
 	argument_t(fixed_t f);
 
 	// handles strings
-	argument_t(std::string s);
+	argument_t(const std::string &s);
+	argument_t(const char *s);
 
 	// handles objects
 	argument_t(object_t *p);
@@ -308,6 +525,28 @@ class array_t {
 
 typedef wl_interface interface_t;
 
+/** \brief Numeric identifier of an interface
+
+    The FNV-1a hash of the interface name as seen on the wire
+    (e.g. "wl_surface"). The scanner emits it as interface_id in
+    every generated class and rejects protocols with colliding IDs,
+    so checking the class of an object is a single comparison:
+
+    \code{.cpp}
+    if(proxy.get_class_id() == surface_proxy_t::interface_id)
+        ...
+    \endcode
+*/
+typedef uint32_t interface_id_t;
+
+/** \brief Entry of the interface table generated for each protocol
+*/
+struct interface_info_t {
+	const char *name;
+	interface_id_t id;
+	const wl_interface *interface;
+};
+
 }
 
 #endif
@@ -16,8 +16,10 @@
  */
 
 #include <assert.h>
+#include <cstdio>
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <list>
 #include <set>
@@ -25,19 +27,74 @@
 #include <cctype>
 #include <cmath>
 #include <algorithm>
+#include <map>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <cstdlib>
 
 #include "pugixml.hpp"
 
 using namespace std;
 using namespace pugi;
 
-std::list<std::string> interface_names;
+// must match wayland::detail::fnv1a
+uint32_t fnv1a(const std::string &s) {
+	uint32_t h = 2166136261u;
+	for (char c : s) {
+		h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+	}
+	return h;
+}
+
+/* Writes the separator before every item but the first, so lists can be
+   streamed without trimming a trailing separator off the buffer:
+
+     separator_t sep;
+     for (auto &arg : args)
+         os << sep << arg.name;
+*/
+class separator_t {
+	const char *sep;
+	bool first;
+
+public:
+	separator_t(const char *s = ", ")
+		: sep(s), first(true) {
+	}
+
+	friend std::ostream &operator<<(std::ostream &os, separator_t &s) {
+		if (!s.first)
+			os << s.sep;
+		s.first = false;
+		return os;
+	}
+};
 
 enum source_t {
 	SERVER = 1,
 	CLIENT,
 };
 
+// also emit a virtual handler_t per server interface (--handlers)
+bool gen_handlers = false;
+// translation units per side: 1 by default, 0 for one per interface
+// (--split), otherwise that many balanced shards (--shards N)
+unsigned int source_shards = 1;
+// lowest version each interface is ever bound with (--min-version name=N),
+// messages up to it are sent without checking the version
+std::map<std::string, int> min_versions;
+
+// interfaces whose client objects come and go every frame (--pool name),
+// their event tables are recycled instead of allocated each time
+std::set<std::string> pooled_interfaces = { "wl_callback", "wl_region" };
+
+int min_version(const std::string &iface) {
+	auto it = min_versions.find(iface);
+	return it != min_versions.end() ? std::max(1, it->second) : 1;
+}
+
 struct element_t {
 	std::string summary;
 	std::string description;
@@ -120,37 +177,78 @@ struct event_t : public element_t {
 	std::string name;
 	std::list<argument_t> args;
 	int since;
+	// not every bound version has it, check before sending
+	bool guarded;
 
 	std::string print_functional() {
 		std::stringstream ss;
+		separator_t sep;
 		ss << "        std::function<void(";
 		for (auto &arg : args)
-			ss << arg.print_type(CLIENT) << ", ";
-		if (args.size())
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+			ss << sep << arg.print_type(CLIENT);
 		ss << ")> " << name << ";";
 		return ss.str();
 	}
 
+	// libwayland signature string
+	std::string print_signature() {
+		std::stringstream ss;
+		if (since > 1)
+			ss << since;
+		for (auto &arg : args) {
+			if (arg.allow_null)
+				ss << "?";
+			if (arg.type == "new_id" && arg.interface == "")
+				ss << "su";
+			ss << arg.print_short();
+		}
+		return ss.str();
+	}
+
+	// compile-time descriptor, see detail::message_t
+	std::string print_descriptor() {
+		std::stringstream ss;
+		uint32_t nullable = 0;
+		unsigned int n = 0;
+		std::stringstream kinds;
+		for (auto &arg : args) {
+			if (arg.allow_null)
+				nullable |= 1u << n;
+			if (arg.type == "new_id" && arg.interface == "") {
+				kinds << ", detail::arg_kind::string, detail::arg_kind::uint32";
+				n += 2;
+			}
+			kinds << ", detail::arg_kind::";
+			if (arg.type == "int")
+				kinds << "int32";
+			else if (arg.type == "uint")
+				kinds << "uint32";
+			else
+				kinds << arg.type;
+			n++;
+		}
+		ss << "            typedef detail::message_t<" << opcode << ", " << since << ", 0x"
+		   << std::hex << nullable << std::dec << kinds.str() << "> " << name << ";";
+		return ss.str();
+	}
+
 	std::string print_dispatcher(int opcode) {
 		std::stringstream ss;
 		ss << "    case " << opcode << ":" << std::endl
 		   << "        if(events->" << name << ") events->" << name << "(";
 
 		int c = 0;
-		for (auto &arg : args)
+		separator_t sep;
+		for (auto &arg : args) {
+			ss << sep;
 			if (arg.enum_name != "") {
-				ss << arg.print_type(CLIENT) << "(args[" << c++ << "].get<uint32_t>()), ";
+				ss << arg.print_type(CLIENT) << "(args[" << c++ << "].get<uint32_t>())";
 			} else if (arg.interface != "") {
-				ss << arg.print_type(CLIENT) << "(args[" << c++ << "].get<proxy_t>()), ";
+				ss << arg.print_type(CLIENT) << "(args[" << c++ << "].get<proxy_t>())";
 			} else {
-				ss << "args[" << c++ << "].get<" << arg.print_type(CLIENT) << ">(), ";
+				ss << "args[" << c++ << "].get<" << arg.print_type(CLIENT) << ">()";
 			}
-		if (args.size()) {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
 		}
-		ss.seekp(0, std::ios_base::end);
 		ss << ");" << std::endl
 		   << "        break;";
 		return ss.str();
@@ -172,12 +270,14 @@ struct event_t : public element_t {
 					ss << std::endl;
 				}
 			}
-			ss << description << std::endl
+			ss << "        \\return false if the client bound a version without this event" << std::endl
+			   << description << std::endl
 			   << "     */" << std::endl;
 		}
 
-		ss << "    void send_" << name << "(";
+		ss << "    bool send_" << name << "(";
 
+		separator_t sep;
 		for (auto &arg : args) {
 			if (arg.type == "new_id") {
 				if (arg.interface == "") {
@@ -187,23 +287,19 @@ struct event_t : public element_t {
 				}
 			} else {
 			}
-			ss << arg.print_argument(SERVER) << ", ";
-		}
-
-		if (ss.str().substr(ss.str().size() - 2, 2) == ", ") {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
+			ss << sep << arg.print_argument(SERVER);
 		}
-		ss.seekp(0, std::ios_base::end);
 		ss << ");" << std::endl;
 		return ss.str();
 	}
 
 	std::string print_body(std::string interface_name) {
 		std::stringstream ss;
-		ss <<  "void ";
+		ss <<  "bool ";
 		ss << interface_name << "_resource_t::send_" << name << "(";
 
 		// bool new_id_arg = false;
+		separator_t params;
 		for (auto &arg : args) {
 			if (arg.type == "new_id") {
 				if (arg.interface == "") {
@@ -213,37 +309,32 @@ struct event_t : public element_t {
 				}
 			} else {
 			}
-			ss << arg.print_argument(SERVER) << ", ";
+			ss << params << arg.print_argument(SERVER);
 		}
-
-		if (ss.str().substr(ss.str().size() - 2, 2) == ", ") {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		}
-
-		ss.seekp(0, std::ios_base::end);
 		ss << ") {" << std::endl;
 
-		ss << "    post_event(" << opcode << ", ";
+		if (guarded)
+			ss << "    if(get_version() < messages::event::" << name << "::since)" << std::endl
+			   << "        return false;" << std::endl;
+
+		ss << "    post_event(" << opcode;
 
 		for (auto &arg : args) {
 			if (arg.type == "new_id") {
 				if (arg.interface == "") {
-					// ss << "std::string(interface.get_iface_ptr()->name), version, ";
+					// ss << ", std::string(interface.get_iface_ptr()->name), version";
 					assert(0);
 				}
-				// ss << "NULL, ";
-				ss << "&" << arg.name + ", ";
+				// ss << ", NULL";
+				ss << ", &" << arg.name;
 			} else if (arg.type == "object") {
-				ss << "&" << arg.name + ", ";
+				ss << ", &" << arg.name;
 			} else if (arg.enum_name != "") {
-				ss << "static_cast<uint32_t>(" << arg.name + "), ";
+				ss << ", static_cast<uint32_t>(" << arg.name + ")";
 			} else {
-				ss << arg.name + ", ";
+				ss << ", " << arg.name;
 			}
 		}
-
-		ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
 		ss << ");" << std::endl;
 
 		if (ret.name != "") {
@@ -254,7 +345,8 @@ struct event_t : public element_t {
 			// } else
 			// 	ss << "    return " << ret.print_type() << "(p);" << std::endl;
 		}
-		ss << "}" << endl;
+		ss << "    return true;" << std::endl
+		   << "}" << endl;
 		return ss.str();
 	}
 
@@ -271,12 +363,10 @@ struct event_t : public element_t {
 			ss << description << std::endl
 			   << "     */" << std::endl;
 		}
+		separator_t sep;
 		ss << "    std::function<void(";
 		for (auto &arg : args)
-			ss << arg.print_type(CLIENT) + ", ";
-		if (args.size())
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+			ss << sep << arg.print_type(CLIENT);
 		ss << ")> &on_" <<  name << "();" << std::endl;
 
 		return ss.str();
@@ -284,14 +374,10 @@ struct event_t : public element_t {
 
 	std::string print_signal_body(std::string interface_name) {
 		std::stringstream ss;
+		separator_t sep;
 		ss << "std::function<void(";
-		for (auto &arg : args) {
-			ss << arg.print_type(CLIENT) << ", ";
-		}
-		if (args.size()) {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		}
-		ss.seekp(0, std::ios_base::end);
+		for (auto &arg : args)
+			ss << sep << arg.print_type(CLIENT);
 		ss << ")> &" << endl;
 	   	ss <<  interface_name + "_proxy_t::on_" + name + "() {" << std::endl
 		   << "    return std::static_pointer_cast<events_t>(get_events())->" + name + ";" << std::endl
@@ -304,37 +390,105 @@ struct request_t : public event_t {
 
 	std::string print_functional() {
 		std::stringstream ss;
+		separator_t sep;
 		ss << "        std::function<void(";
-		for (auto &arg : args) {
-			ss << arg.print_type(SERVER) << ", ";
-		}
-		if (args.size())
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+		for (auto &arg : args)
+			ss << sep << arg.print_type(SERVER);
 		ss << ")> " << name << ";";
 		return ss.str();
 	}
 
-	std::string print_dispatcher(int opcode) {
+	std::string print_thunk_decl() {
 		std::stringstream ss;
-		ss << "    case " << opcode << ":" << std::endl
-		   << "        if(requests->" << name << ") requests->" << name << "(";
+		ss << "    static int request_" << name << "(resource_t &res, resource_t::requests_base_t *r, const wl_message *message, wl_argument *args);";
+		if (gen_handlers)
+			ss << std::endl
+			   << "    static int handle_" << name << "(resource_t &res, resource_t::requests_base_t *r, const wl_message *message, wl_argument *args);";
+		return ss.str();
+	}
 
+	// decodes the wl_arguments of this request with the types known
+	// here, so nothing has to look at the signature at runtime
+	std::string print_decoded_args() {
+		std::stringstream ss;
 		int c = 0;
-		for (auto &arg : args)
+		bool first = true;
+		for (auto &arg : args) {
+			if (!first)
+				ss << ", ";
+			first = false;
 			if (arg.enum_name != "") {
-				ss << arg.print_type(SERVER) << "(args[" << c++ << "].get<uint32_t>()), ";
+				ss << arg.print_type(SERVER) << "(args[" << c << "].u)";
+			} else if (arg.type == "int") {
+				ss << "args[" << c << "].i";
+			} else if (arg.type == "uint") {
+				ss << "args[" << c << "].u";
+			} else if (arg.type == "fd") {
+				ss << "args[" << c << "].h";
+			} else if (arg.type == "fixed") {
+				ss << "arg_fixed(args[" << c << "])";
+			} else if (arg.type == "string") {
+				ss << "arg_string(args[" << c << "])";
+			} else if (arg.type == "array") {
+				ss << "arg_array(args[" << c << "])";
+			} else if (arg.type == "new_id") {
+				if (arg.interface == "") {
+					// untyped new_id goes over the wire as (interface, version, id)
+					c += 2;
+					ss << "arg_new_id(res, message, " << c << ", args[" << c << "])";
+				} else {
+					ss << arg.print_type(SERVER) << "(arg_new_id(res, message, " << c << ", args[" << c << "]))";
+				}
 			} else if (arg.interface != "") {
-				ss << arg.print_type(SERVER) << "(args[" << c++ << "].get<resource_t>()), ";
+				ss << arg.print_type(SERVER) << "(arg_object(args[" << c << "]))";
 			} else {
-				ss << "args[" << c++ << "].get<" << arg.print_type(SERVER) << ">(), ";
+				ss << "arg_object(args[" << c << "])";
 			}
-		if (args.size()) {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
+			c++;
 		}
-		ss.seekp(0, std::ios_base::end);
-		ss << ");" << std::endl
-		   << "        break;";
+		return ss.str();
+	}
+
+	std::string print_thunk(std::string class_name) {
+		std::stringstream ss;
+		ss << "int " << class_name << "::request_" << name << "(resource_t &res, resource_t::requests_base_t *r, const wl_message *message, wl_argument *args) {" << std::endl
+		   << "    requests_t *requests = static_cast<requests_t*>(r);" << std::endl
+		   << "    if(requests && requests->" << name << ")" << std::endl
+		   << "        requests->" << name << "(" << print_decoded_args() << ");" << std::endl
+		   << "    return 0;" << std::endl
+		   << "}" << std::endl;
+		if (gen_handlers) {
+			std::string decoded = print_decoded_args();
+			ss << std::endl
+			   << "int " << class_name << "::handle_" << name << "(resource_t &res, resource_t::requests_base_t *r, const wl_message *message, wl_argument *args) {" << std::endl
+			   << "    " << class_name << " self(res);" << std::endl
+			   << "    static_cast<handler_t*>(r)->on_" << name << "(self" << (decoded.empty() ? "" : ", ") << decoded << ");" << std::endl
+			   << "    return 0;" << std::endl
+			   << "}" << std::endl;
+		}
+		return ss.str();
+	}
+
+	std::string print_handler_params(std::string class_name) {
+		std::stringstream ss;
+		ss << class_name << " &resource";
+		for (auto &arg : args) {
+			ss << ", " << arg.print_type(SERVER) << " " << arg.name;
+		}
+		return ss.str();
+	}
+
+	std::string print_handler_decl(std::string class_name) {
+		std::stringstream ss;
+		ss << "        virtual void on_" << name << "(" << print_handler_params(class_name) << ");";
+		return ss.str();
+	}
+
+	// default handlers ignore the request, like an unset on_*() slot
+	std::string print_handler_body(std::string class_name) {
+		std::stringstream ss;
+		ss << "void " << class_name << "::handler_t::on_" << name << "(" << print_handler_params(class_name) << ") {" << std::endl
+		   << "}" << std::endl;
 		return ss.str();
 	}
 
@@ -357,6 +511,8 @@ struct request_t : public event_t {
 					ss << std::endl;
 				}
 			}
+			if (guarded)
+				ss << "        \\throw std::runtime_error if the proxy version is below " << since << std::endl;
 			ss << description << std::endl
 			   << "     */" << std::endl;
 		}
@@ -430,16 +586,13 @@ struct request_t : public event_t {
 			ss << "    " << ret.print_type(CLIENT) << " ";
 		ss << name << "(";
 
+		separator_t sep;
 		for (auto &arg : args)
 			if (arg.type == "new_id") {
 				if (arg.interface == "")
-					ss << "proxy_t &interface, uint32_t version, ";
+					ss << sep << "proxy_t &interface, uint32_t version";
 			} else
-				ss << arg.print_argument(CLIENT) << ", ";
-
-		if (ss.str().substr(ss.str().size() - 2, 2) == ", ")
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+				ss << sep << arg.print_argument(CLIENT);
 		ss << ");" << std::endl;
 		return ss.str();
 	}
@@ -457,13 +610,10 @@ struct request_t : public event_t {
 			ss << description << std::endl
 			   << "     */" << std::endl;
 		}
+		separator_t sep;
 		ss << "    std::function<void(";
-		for (auto &arg : args) {
-			ss << arg.print_type(SERVER) + ", ";
-		}
-		if (args.size())
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+		for (auto &arg : args)
+			ss << sep << arg.print_type(SERVER);
 		ss << ")> &on_" <<  name << "();" << std::endl;
 
 		return ss.str();
@@ -482,15 +632,13 @@ struct request_t : public event_t {
 		// 	ss << description << std::endl
 		// 	   << " */" << std::endl;
 		// }
+		separator_t sep;
 		ss << "std::function<void(";
 		for (auto &arg : args)
-			ss << arg.print_type(SERVER) + ", ";
-		if (args.size())
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
+			ss << sep << arg.print_type(SERVER);
 		ss << ")> &" << endl
 		   << interface_name << "_resource_t::on_" <<  name << "() {" << std::endl
-		   << "    return std::static_pointer_cast<requests_t>(get_requests())->" + name + ";" << std::endl
+		   << "    return requests()." + name + ";" << std::endl
 		   << "}" << std::endl;
 		return ss.str();
 	}
@@ -504,55 +652,55 @@ struct request_t : public event_t {
 		ss << interface_name << "_proxy_t::" << name << "(";
 
 		bool new_id_arg = false;
+		separator_t params;
 		for (auto &arg : args) {
 			if (arg.type == "new_id") {
 				if (arg.interface == "") {
-					ss << "proxy_t &interface, uint32_t version, ";
+					ss << params << "proxy_t &interface, uint32_t version";
 					new_id_arg = true;
 				}
 			} else {
-				ss << arg.print_argument(CLIENT) << ", ";
+				ss << params << arg.print_argument(CLIENT);
 			}
 		}
-
-		if (ss.str().substr(ss.str().size() - 2, 2) == ", ") {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-		}
-
-		ss.seekp(0, std::ios_base::end);
 		ss << ") {" << std::endl;
 
+		// the compositor would kill the connection for it
+		if (guarded)
+			ss << "    if(get_version() < messages::request::" << name << "::since)" << std::endl
+			   << "        throw std::runtime_error(\"" << interface_name << "_proxy_t::" << name
+			   << ": needs version " << since << ".\");" << std::endl;
+
 		if (ret.name == "") {
-			ss << "    marshal(" << opcode << ", ";
+			ss << "    marshal(" << opcode;
 		} else {
-			ss << "    proxy_t p = marshal_constructor(" << opcode << ", ";
+			if (new_id_arg)
+				ss << "    proxy_t p = marshal_constructor_versioned(" << opcode << ", ";
+			else
+				ss << "    proxy_t p = marshal_constructor(" << opcode << ", ";
 			if (ret.interface == "") {
 				//ss << "    proxy_t p = marshal_constructor_dynamic(" << opcode << ", interface";
-				ss << "interface.get_iface_ptr()";
+				ss << "interface.get_iface_ptr(), version";
 			} else {
 				//ss << "    proxy_t p = marshal_constructor(" << opcode << ", ";
 				ss << "&" << ret.interface << "_interface";
 			}
-			ss << ", ";
 		}
 
 		for (auto &arg : args) {
 			if (arg.type == "new_id") {
 				if (arg.interface == "") {
-					ss << "std::string(interface.get_iface_ptr()->name), version, ";
+					ss << ", interface.get_iface_ptr()->name, version";
 				}
-				ss << "NULL, ";
+				ss << ", NULL";
 			} else if (arg.type == "object") {
-				ss << "&" << arg.name + ", ";
+				ss << ", &" << arg.name;
 			} else if (arg.enum_name != "") {
-				ss << "static_cast<uint32_t>(" << arg.name + "), ";
+				ss << ", static_cast<uint32_t>(" << arg.name + ")";
 			} else {
-				ss << arg.name + ", ";
+				ss << ", " << arg.name;
 			}
 		}
-
-		ss.str(ss.str().substr(0, ss.str().size() - 2));
-		ss.seekp(0, std::ios_base::end);
 		ss << ");" << std::endl;
 
 		if (ret.name != "") {
@@ -606,7 +754,10 @@ struct enumeration_t : public element_t {
 			   << "        : detail::bitfield<" << width << ", " << id << ">(value) {}" << std::endl;
 		}
 
+		// enum class entries are comma separated, bitfield ones are statements
+		separator_t sep(bitfield ? "" : ",\n");
 		for (auto &entry : entries) {
+			ss << sep;
 			if (entry.description != "") {
 				ss << "    /** \\brief " << entry.summary << std::endl
 				   << entry.description << std::endl
@@ -614,17 +765,14 @@ struct enumeration_t : public element_t {
 			}
 
 			if (!bitfield) {
-				ss << "    " << entry.name << " = " << entry.value << "," << std::endl;
+				ss << "    " << entry.name << " = " << entry.value;
 			} else {
 				ss << "    static const detail::bitfield<" << width << ", " << id << "> " << entry.name << ";" << std::endl;
 			}
 		}
 
-		if (!bitfield) {
-			ss.str(ss.str().substr(0, ss.str().size() - 2));
-			ss.seekp(0, std::ios_base::end);
+		if (!bitfield)
 			ss << std::endl;
-		}
 
 		ss << "};" << std::endl;
 		return ss.str();
@@ -654,8 +802,41 @@ struct interface_t : public element_t {
 
 	//std::string proxyclass_name;
 
-	std::string print_forward(source_t stype) {
+	std::string print_id() const {
+		std::stringstream ss;
+		ss << "0x" << std::hex << std::setw(8) << std::setfill('0') << fnv1a(orig_name) << "u";
+		return ss.str();
+	}
+
+	std::string print_class_constants() {
 		std::stringstream ss;
+		ss << "    static constexpr const char *interface_name = \"" << orig_name << "\";" << std::endl
+		   << "    static constexpr interface_id_t interface_id = " << print_id() << ";" << std::endl
+		   << std::endl
+		   << "    /** \\brief Compile-time descriptors of the messages of " << orig_name << " */" << std::endl
+		   << "    struct messages {" << std::endl
+		   << "        struct request {" << std::endl;
+		for (auto &request : requests)
+			ss << request.print_descriptor() << std::endl;
+		ss << "        };" << std::endl
+		   << "        struct event {" << std::endl;
+		for (auto &event : events)
+			ss << event.print_descriptor() << std::endl;
+		ss << "        };" << std::endl
+		   << "    };" << std::endl
+		   << std::endl;
+		return ss.str();
+	}
+
+	std::string print_class_constant_defs(const std::string &class_name) {
+		std::stringstream ss;
+		ss << "constexpr const char *" << class_name << "::interface_name;" << std::endl
+		   << "constexpr interface_id_t " << class_name << "::interface_id;" << std::endl
+		   << std::endl;
+		return ss.str();
+	}
+
+	void print_forward(std::ostream &ss, source_t stype) {
 		if (stype == SERVER) {
 			ss << "class " << server_class << ";" << std::endl;
 			for (auto &e : enums) {
@@ -668,11 +849,9 @@ struct interface_t : public element_t {
 			}
 		}
 		ss << std::endl;
-		return ss.str();
 	}
 
-	std::string print_header(source_t stype) {
-		std::stringstream ss;
+	void print_header(std::ostream &ss, source_t stype) {
 		if (description != "") {
 			ss << "/** \\brief " << summary << std::endl
 			   << description << std::endl
@@ -690,17 +869,53 @@ struct interface_t : public element_t {
 			}
 
 			ss << "    };" << std::endl
-				<< std::endl
-				<< "    static int dispatcher(int opcode, std::vector<detail::any> args, std::shared_ptr<resource_t::requests_base_t> e);" << std::endl
 				<< std::endl;
 
+			// one thunk per request, indexed by opcode
+			for (auto &request : requests) {
+				ss << request.print_thunk_decl() << std::endl;
+			}
+			if (requests.size()) {
+				ss << "    static const resource_t::request_thunk_t request_thunks[" << requests.size() << "];" << std::endl;
+				if (gen_handlers)
+					ss << "    static const resource_t::request_thunk_t handler_thunks[" << requests.size() << "];" << std::endl;
+				ss << std::endl
+				   << "    // the requests_t behind the on_*() slots, created on first use" << std::endl
+				   << "    requests_t &requests();" << std::endl;
+			}
+			ss << std::endl;
+
 			ss << "public:" << std::endl
+				<< print_class_constants()
 				<< "    " << server_class << "();" << std::endl
 				<< "    explicit " << server_class << "(const resource_t &resource);" << std::endl
 				<< std::endl
 				<< "    void bind();" << std::endl
 				<< std::endl;
 
+			if (gen_handlers && requests.size()) {
+				ss << "    /** \\brief Receives all requests of " << server_class << " through virtual calls" << std::endl
+				   << std::endl
+				   << "        An alternative to the on_*() slots. One handler can serve any" << std::endl
+				   << "        number of resources, each of which then only keeps a pointer to" << std::endl
+				   << "        it. Unimplemented requests are ignored." << std::endl
+				   << "     */" << std::endl
+				   << "    class handler_t : public resource_t::requests_base_t {" << std::endl
+				   << "    public:" << std::endl;
+				for (auto &request : requests) {
+					ss << request.print_handler_decl(server_class) << std::endl;
+				}
+				ss << "    };" << std::endl
+				   << std::endl
+				   << "    /** \\brief Route all requests of this resource to a handler" << std::endl
+				   << "        \\param handler Handler to call, shared with other resources" << std::endl
+				   << std::endl
+				   << "        Can only be used instead of the on_*() slots, not together with them." << std::endl
+				   << "     */" << std::endl
+				   << "    void set_handler(std::shared_ptr<handler_t> handler);" << std::endl
+				   << std::endl;
+			}
+
 			for (auto &request : requests) {
 				ss << request.print_handle_header() << std::endl;
 			}
@@ -725,6 +940,7 @@ struct interface_t : public element_t {
 				<< std::endl;
 
 			ss << "public:" << std::endl
+				<< print_class_constants()
 				<< "    " << client_class << "();" << std::endl
 				<< "    explicit " << client_class << "(const proxy_t &proxy);" << std::endl
 				<< std::endl;
@@ -747,13 +963,10 @@ struct interface_t : public element_t {
 			ss << enumeration.print_header(name) << std::endl;
 		}
 
-		return ss.str();
 	}
 
-	std::string print_interface_header() {
-		std::stringstream ss;
+	void print_interface_header(std::ostream &ss) {
 		ss << "    extern const wl_interface " << name << "_interface;" << std::endl;
-		return ss.str();
 	}
 
 	// std::string print_body() {
@@ -803,8 +1016,7 @@ struct interface_t : public element_t {
 	// 	return ss.str();
 	// }
 
-	std::string print_common_defs(const std::string &protocol_name) {
-		std::stringstream ss;
+	void print_common_defs(std::ostream &ss, const std::string &protocol_name) {
 		ss << "const wl_interface wayland::detail::" << name << "_interface = {" << std::endl
 		   << "    \"" << orig_name << "\"," << std::endl
 		   << "    " << version << "," << std::endl
@@ -813,22 +1025,13 @@ struct interface_t : public element_t {
 		for (auto &request : requests) {
 			ss << "        {" << std::endl
 			   << "            \"" << request.name << "\"," << std::endl
-			   << "            \"";
-			if (request.since > 1) {
-				ss << request.since;
-			}
+			   << "            \"" << request.print_signature() << "\"," << std::endl
+			   << "            (const wl_interface*[]) {" << std::endl;
 			for (auto &arg : request.args) {
-				if (arg.allow_null) {
-					ss << "?";
-				}
 				if (arg.type == "new_id" && arg.interface == "") {
-					ss << "su";
+					ss  << "                NULL," << std::endl
+					    << "                NULL," << std::endl;
 				}
-				ss << arg.print_short();
-			}
-			ss << "\"," << std::endl
-			   << "            (const wl_interface*[]) {" << std::endl;
-			for (auto &arg : request.args) {
 				if (arg.interface != "") {
 					ss  << "                &" << arg.interface << "_interface," << std::endl;
 				} else {
@@ -844,22 +1047,13 @@ struct interface_t : public element_t {
 		for (auto &event : events) {
 			ss << "        {" << std::endl
 			   << "            \"" << event.name << "\"," << std::endl
-			   << "            \"";
-			if (event.since > 1) {
-				ss << event.since;
-			}
+			   << "            \"" << event.print_signature() << "\"," << std::endl
+			   << "            (const wl_interface*[]) {" << std::endl;
 			for (auto &arg : event.args) {
-				if (arg.allow_null) {
-					ss << "?";
-				}
 				if (arg.type == "new_id" && arg.interface == "") {
-					ss << "su";
+					ss  << "                NULL," << std::endl
+					    << "                NULL," << std::endl;
 				}
-				ss << arg.print_short();
-			}
-			ss << "\"," << std::endl
-			   << "            (const wl_interface*[]) {" << std::endl;
-			for (auto &arg : event.args) {
 				if (arg.interface != "") {
 					ss  << "                &" << arg.interface << "_interface," << std::endl;
 				} else {
@@ -878,13 +1072,13 @@ struct interface_t : public element_t {
 
 		ss << std::endl;
 
-		return ss.str();
 	}
 
-	std::string print_memdef(source_t stype) {
-		std::stringstream ss;
+	void print_memdef(std::ostream &ss, source_t stype) {
 
 		if (stype == SERVER) {
+			ss << print_class_constant_defs(server_class);
+
 			// constructor
 			ss << server_class << "::" << server_class << "(const resource_t &p)" << std::endl
 			   << "  : resource_t(p) {" << std::endl
@@ -905,28 +1099,53 @@ struct interface_t : public element_t {
 
 			// bind
 			ss << "void " << server_class << "::bind() {" << std::endl
-			   << "    set_requests(std::shared_ptr<resource_t::requests_base_t>(new requests_t), dispatcher);" << std::endl
+			   << "    set_requests(nullptr, " << (requests.size() ? "request_thunks" : "nullptr") << ");" << std::endl
 			   << "}" << std::endl
 			   << std::endl;
 
-			// dispatcher
-			ss << "int " << server_class << "::dispatcher(int opcode, std::vector<any> args, std::shared_ptr<resource_t::requests_base_t> e) {" << std::endl
-			   << std::endl;
-	
 			if (requests.size()) {
-				ss << "    std::shared_ptr<requests_t> requests = std::static_pointer_cast<requests_t>(e);" << std::endl
-				   << "    switch(opcode) {" << std::endl;
-	
-				int opcode = 0;
+				ss << server_class << "::requests_t &" << server_class << "::requests() {" << std::endl
+				   << "    if(!get_requests())" << std::endl
+				   << "        set_requests(make_requests<requests_t>(), request_thunks);" << std::endl
+				   << "    if(get_request_thunks() != request_thunks)" << std::endl
+				   << "        throw std::runtime_error(\"" << server_class << ": requests are routed to a handler.\");" << std::endl
+				   << "    return *static_cast<requests_t*>(get_requests().get());" << std::endl
+				   << "}" << std::endl
+				   << std::endl;
+			}
+
+			if (gen_handlers && requests.size()) {
+				ss << "void " << server_class << "::set_handler(std::shared_ptr<handler_t> handler) {" << std::endl
+				   << "    if(get_requests())" << std::endl
+				   << "        throw std::runtime_error(\"" << server_class << ": requests already have a receiver.\");" << std::endl
+				   << "    set_requests(handler, handler_thunks);" << std::endl
+				   << "}" << std::endl
+				   << std::endl;
 				for (auto &request : requests) {
-					ss << request.print_dispatcher(opcode++) << std::endl;
+					ss << request.print_handler_body(server_class) << std::endl;
+				}
+			}
+
+			// request thunks
+			for (auto &request : requests) {
+				ss << request.print_thunk(server_class) << std::endl;
+			}
+			if (requests.size()) {
+				ss << "constexpr resource_t::request_thunk_t " << server_class << "::request_thunks[" << requests.size() << "] = {" << std::endl;
+				for (auto &request : requests) {
+					ss << "    &" << server_class << "::request_" << request.name << "," << std::endl;
+				}
+				ss << "};" << std::endl
+				   << std::endl;
+				if (gen_handlers) {
+					ss << "constexpr resource_t::request_thunk_t " << server_class << "::handler_thunks[" << requests.size() << "] = {" << std::endl;
+					for (auto &request : requests) {
+						ss << "    &" << server_class << "::handle_" << request.name << "," << std::endl;
+					}
+					ss << "};" << std::endl
+					   << std::endl;
 				}
-	
-				ss << "    }" << std::endl;
 			}
-	
-			ss << "    return 0;" << std::endl
-			   << "}" << std::endl;
 
 			for (auto &event : events) {
 				ss << event.print_body(name) << std::endl;
@@ -935,9 +1154,16 @@ struct interface_t : public element_t {
 				ss << request.print_handle_body(name) << std::endl;
 			}
 		} else if (stype == CLIENT) {
+			ss << print_class_constant_defs(client_class);
+
 			ss << client_class << "::" << client_class << "(const proxy_t &p)" << std::endl
 			   << "  : proxy_t(p) {" << std::endl
-			   << "    set_events(std::shared_ptr<proxy_t::events_base_t>(new events_t), dispatcher);" << std::endl
+			   << "    if(!get_events())" << std::endl;
+			if (pooled_interfaces.count(orig_name))
+				ss << "        set_events(std::allocate_shared<events_t>(detail::pool_allocator<events_t>()), dispatcher);" << std::endl;
+			else
+				ss << "        set_events(std::make_shared<events_t>(), dispatcher);" << std::endl;
+			ss
 			   << "    set_destroy_opcode(" << destroy_opcode << ");" << std::endl
 			   << "    interface = &" << name << "_interface;" << std::endl
 			   << "    copy_constructor = [] (const proxy_t &p) -> proxy_t" << std::endl
@@ -981,13 +1207,17 @@ struct interface_t : public element_t {
 		}
 		ss << std::endl;
 
-		return ss.str();
 	}
 };
 
 struct protocol_t : public element_t {
 	std::string name;
 	std::list<interface_t> interfaces;
+	// protocols whose generated headers this one includes
+	std::list<std::string> imports;
+
+	protocol_t() {
+	}
 
 	protocol_t(const xml_node &protocol_node) {
 		name = protocol_node.attribute("name").value();
@@ -1019,8 +1249,6 @@ struct protocol_t : public element_t {
 				iface.description = description.text().get();
 			}
 
-			interface_names.push_back(iface.name);
-
 			int opcode = 0; // Opcodes are in order of the XML. (Sadly undocumented)
 			for (xml_node &request : interface.children("request")) {
 				request_t req;
@@ -1031,6 +1259,7 @@ struct protocol_t : public element_t {
 					req.since = std::stoi(std::string(request.attribute("since").value()));
 				else
 					req.since = 1;
+				req.guarded = req.since > min_version(iface.orig_name);
 
 				if (request.child("description")) {
 					xml_node description = request.child("description");
@@ -1094,6 +1323,7 @@ struct protocol_t : public element_t {
 					ev.since = std::stoi(std::string(event.attribute("since").value()));
 				else
 					ev.since = 1;
+				ev.guarded = ev.since > min_version(iface.orig_name);
 
 				if (event.child("description")) {
 					xml_node description = event.child("description");
@@ -1173,7 +1403,9 @@ struct protocol_t : public element_t {
 						enum_entry.description = description.text().get();
 					}
 
-					uint32_t tmp = std::floor(std::log2(stol(enum_entry.value))) + 1;
+					// values may be hex (presentation-time uses 0x1, 0x2, ...)
+					long value = stol(enum_entry.value, nullptr, 0);
+					uint32_t tmp = value > 0 ? std::floor(std::log2(value)) + 1 : 0;
 					if (tmp > enu.width) {
 						enu.width = tmp;
 					}
@@ -1188,49 +1420,178 @@ struct protocol_t : public element_t {
 	}
 };
 
+/* Generated file that is only replaced if its content changed, so make
+   does not rebuild everything that includes it after every scanner run.
+   The code is streamed into a temporary file next to the target, which
+   commit() either renames over the target or removes.
+*/
+class output_file_t : public std::ofstream {
+	std::string path;
+	std::string tmp_path;
+
+	// FNV-1a over the file content, false if it cannot be read
+	static bool hash_file(const std::string &filename, uint64_t &hash) {
+		std::ifstream in(filename, std::ios_base::binary);
+		if (!in)
+			return false;
+		hash = 14695981039346656037ull;
+		char buf[4096];
+		while (in.read(buf, sizeof buf) || in.gcount()) {
+			for (std::streamsize i = 0; i < in.gcount(); i++)
+				hash = (hash ^ static_cast<uint8_t>(buf[i])) * 1099511628211ull;
+		}
+		return true;
+	}
+
+public:
+	output_file_t(const std::string &filename)
+		: std::ofstream(filename + ".tmp", std::ios_base::out | std::ios_base::trunc),
+		  path(filename), tmp_path(filename + ".tmp") {
+	}
+
+	bool commit() {
+		close();
+		if (fail()) {
+			std::cerr << "Failed to write " << tmp_path << std::endl;
+			std::remove(tmp_path.c_str());
+			return false;
+		}
+
+		uint64_t old_hash, new_hash;
+		if (hash_file(path, old_hash) && hash_file(tmp_path, new_hash)
+		    && old_hash == new_hash) {
+			std::remove(tmp_path.c_str());
+			return true;
+		}
+
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+			std::cerr << "Failed to replace " << path << std::endl;
+			std::remove(tmp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
 void gen_client_header(std::string filepath,
 		const protocol_t &protocol) {
 }
 
-int main(int argc, char *argv[]) {
-	if (argc < 3) {
-		std::cerr << "Usage:" << std::endl
-		          << "  " << argv[0] << " protocol.xml inc_dir src_dir"
-				  //" server_header.hpp client_header.hpp source.cpp"
-		          << std::endl;
-		return 1;
+// includes for the generated headers of the protocols this one refers to
+std::string print_imports(const protocol_t &protocol, const std::string &side) {
+	std::stringstream ss;
+	for (auto &import : protocol.imports)
+		ss << "#include <" << import << "-" << side << "-protocol.hpp>" << std::endl;
+	return ss.str();
+}
+
+/* Writes the member definitions of one side. By default into a single
+   <protocol>-<side>-protocol.cpp, with --split into one file per
+   interface and with --shards into that many files of about the same
+   size, so the build can compile them in parallel. */
+bool write_sources(protocol_t &protocol, source_t stype, const std::string &src_dir,
+                   std::vector<std::string> &sources) {
+	std::string side = stype == SERVER ? "server" : "client";
+	std::string base = protocol.name + "-" + side + "-protocol";
+	std::vector<interface_t*> interfaces;
+	for (auto &iface : protocol.interfaces)
+		interfaces.push_back(&iface);
+
+	// shard of each interface and the generated code, if split
+	std::vector<unsigned int> shard_of(interfaces.size(), 0);
+	std::vector<std::string> code(interfaces.size());
+	unsigned int shards = 1;
+	if (source_shards != 1 && interfaces.size() > 1) {
+		for (unsigned int c = 0; c < interfaces.size(); c++) {
+			std::stringstream ss;
+			interfaces[c]->print_memdef(ss, stype);
+			code[c] = ss.str();
+		}
+
+		if (source_shards == 0) {
+			shards = interfaces.size();
+			for (unsigned int c = 0; c < interfaces.size(); c++) {
+				shard_of[c] = c;
+				sources.push_back(base + "-" + interfaces[c]->name + ".cpp");
+			}
+		} else {
+			// largest first into the currently smallest shard
+			shards = std::min<unsigned int>(source_shards, interfaces.size());
+			std::vector<unsigned int> order(interfaces.size());
+			for (unsigned int c = 0; c < order.size(); c++)
+				order[c] = c;
+			std::stable_sort(order.begin(), order.end(), [&] (unsigned int l, unsigned int r) {
+				return code[l].size() > code[r].size();
+			});
+			std::vector<size_t> fill(shards, 0);
+			for (unsigned int c : order) {
+				unsigned int smallest = std::min_element(fill.begin(), fill.end()) - fill.begin();
+				shard_of[c] = smallest;
+				fill[smallest] += code[c].size();
+			}
+			for (unsigned int c = 0; c < shards; c++)
+				sources.push_back(base + "-" + std::to_string(c) + ".cpp");
+		}
+	} else {
+		sources.push_back(base + ".cpp");
 	}
 
-	xml_document doc;
-	doc.load_file(argv[1]);
-	xml_node protocol_node = doc.child("protocol");
-	protocol_t protocol(protocol_node);
+	bool ok = true;
+	for (unsigned int shard = 0; shard < shards; shard++) {
+		output_file_t cpp(src_dir + "/" + sources[shard]);
+		cpp << "#include <array>" << std::endl
+		    << "#include <functional>" << std::endl
+		    << "#include <memory>" << std::endl
+		    << "#include <stdexcept>" << std::endl
+		    << "#include <string>" << std::endl
+		    << "#include <vector>" << std::endl
+		    << "#include <wayland-util.hpp>" << std::endl
+		    << "#include <wayland-" << side << "-core.hpp>" << std::endl
+		    << print_imports(protocol, side)
+		    << "#include <" << protocol.name << "-" << side << "-protocol.hpp>" << std::endl
+		    << std::endl
+		    << std::endl
+		    << "namespace wayland {" << std::endl
+		    << std::endl
+		    << "using namespace detail;" << std::endl
+		    << std::endl;
+
+		// class member function definitions
+		for (unsigned int c = 0; c < interfaces.size(); c++) {
+			if (shard_of[c] != shard)
+				continue;
+			if (shards > 1)
+				cpp << code[c];
+			else
+				interfaces[c]->print_memdef(cpp, stype);
+			cpp << std::endl;
+		}
+
+		cpp << std::endl
+		    << "}" << std::endl
+		    << std::endl;
+		ok = cpp.commit() && ok;
+	}
+	return ok;
+}
 
+bool write_protocol(protocol_t &protocol, const std::string &inc_dir, const std::string &src_dir) {
 	std::list<interface_t> &interfaces = protocol.interfaces;
 
+	std::string interface_table_decl = "    extern const interface_info_t " + protocol.name
+		+ "_interfaces[" + std::to_string(interfaces.size()) + "];\n";
+
 	// filenames
-	//std::string ext_name(argv[2]);
-	std::string inc_dir(argv[2]);
-	std::string src_dir(argv[3]);
 	std::string server_header_filename = inc_dir + "/" + protocol.name + "-server-protocol.hpp";
 	std::string client_header_filename = inc_dir + "/" + protocol.name + "-client-protocol.hpp";
-	std::string server_source_filename = src_dir + "/" + protocol.name + "-server-protocol.cpp";
-	std::string client_source_filename = src_dir + "/" + protocol.name + "-client-protocol.cpp";
 	std::string common_source_filename = src_dir + "/" + protocol.name + "-protocol.cpp";
 	//std::string server_header_filename(argv[2]);
 	//std::string client_header_filename(argv[3]);
 	//std::string source_filename(argv[4]);
 
-	std::fstream protocol_server_hpp(server_header_filename,
-	                                std::ios_base::out | std::ios_base::trunc);
-	std::fstream protocol_client_hpp(client_header_filename,
-	                                std::ios_base::out | std::ios_base::trunc);
-	std::fstream protocol_server_cpp(server_source_filename,
-	                         std::ios_base::out | std::ios_base::trunc);
-	std::fstream protocol_client_cpp(client_source_filename,
-	                         std::ios_base::out | std::ios_base::trunc);
-	std::fstream protocol_cpp(common_source_filename,
-	                         std::ios_base::out | std::ios_base::trunc);
+	output_file_t protocol_server_hpp(server_header_filename);
+	output_file_t protocol_client_hpp(client_header_filename);
+	output_file_t protocol_cpp(common_source_filename);
 
 	// header vars
 	std::string server_header_guard = protocol.name + "_SERVER_PROTOCOL_HPP";
@@ -1251,7 +1612,7 @@ int main(int argc, char *argv[]) {
 	                   << "#include <vector>" << std::endl
 	                   << "#include <wayland-util.hpp>" << std::endl
 	                   << "#include <wayland-client-core.hpp>" << std::endl
-	                   << "#include <wayland-client-protocol.hpp>" << std::endl
+	                   << print_imports(protocol, "client")
 	                   << std::endl
 	                   << std::endl
 	                   << "namespace wayland {" << std::endl
@@ -1259,21 +1620,23 @@ int main(int argc, char *argv[]) {
 
 	// forward declarations
 	for (auto &iface : interfaces) {
-		protocol_client_hpp << iface.print_forward(CLIENT);
+		iface.print_forward(protocol_client_hpp, CLIENT);
 	}
 	protocol_client_hpp << std::endl;
 
 	// interface headers
 	protocol_client_hpp << "namespace detail {" << std::endl;
 	for (auto &iface : interfaces) {
-		protocol_client_hpp << iface.print_interface_header();
+		iface.print_interface_header(protocol_client_hpp);
 	}
+	protocol_client_hpp << interface_table_decl;
 	protocol_client_hpp  << "}" << std::endl
 	                    << std::endl;
 
 	// class declarations
 	for (auto &iface : interfaces) {
-		protocol_client_hpp << iface.print_header(CLIENT) << std::endl;
+		iface.print_header(protocol_client_hpp, CLIENT);
+		protocol_client_hpp << std::endl;
 	}
 
 	protocol_client_hpp << std::endl
@@ -1294,7 +1657,7 @@ int main(int argc, char *argv[]) {
 	                   << "#include <vector>" << std::endl
 	                   << "#include <wayland-util.hpp>" << std::endl
 	                   << "#include <wayland-server-core.hpp>" << std::endl
-	                   << "#include <wayland-server-protocol.hpp>" << std::endl
+	                   << print_imports(protocol, "server")
 	                   << std::endl
 	                   << std::endl
 	                   << "namespace wayland {" << std::endl
@@ -1302,21 +1665,23 @@ int main(int argc, char *argv[]) {
 
 	// forward declarations
 	for (auto &iface : interfaces) {
-		protocol_server_hpp << iface.print_forward(SERVER);
+		iface.print_forward(protocol_server_hpp, SERVER);
 	}
 	protocol_server_hpp << std::endl;
 
 	// interface headers
 	protocol_server_hpp << "namespace detail {" << std::endl;
 	for (auto &iface : interfaces) {
-		protocol_server_hpp << iface.print_interface_header();
+		iface.print_interface_header(protocol_server_hpp);
 	}
+	protocol_server_hpp << interface_table_decl;
 	protocol_server_hpp  << "}" << std::endl
 	                    << std::endl;
 
 	// class declarations
 	for (auto &iface : interfaces) {
-		protocol_server_hpp << iface.print_header(SERVER) << std::endl;
+		iface.print_header(protocol_server_hpp, SERVER);
+		protocol_server_hpp << std::endl;
 	}
 
 	protocol_server_hpp << std::endl
@@ -1324,60 +1689,10 @@ int main(int argc, char *argv[]) {
 	                   << std::endl
 	                   << "#endif" << std::endl;
 
-	// source file
-	
-	// server source
-	protocol_server_cpp << "#include <array>" << std::endl
-	                   << "#include <functional>" << std::endl
-	                   << "#include <memory>" << std::endl
-	                   << "#include <string>" << std::endl
-	                   << "#include <vector>" << std::endl
-	                   << "#include <wayland-util.hpp>" << std::endl
-	                   << "#include <wayland-server-core.hpp>" << std::endl
-	                   << "#include <wayland-server-protocol.hpp>" << std::endl
-	                   << "#include <" << protocol.name << "-server-protocol.hpp>" << std::endl
-	                   << std::endl
-	                   << std::endl
-	                   << "namespace wayland {" << std::endl
-	                   << std::endl
-					   << "using namespace detail;" << std::endl
-	                   << std::endl;
-
-	// class member function definitions
-	for (auto &iface : interfaces) {
-		protocol_server_cpp << iface.print_memdef(SERVER) << std::endl;
-	}
-
-	protocol_server_cpp << std::endl
-	                   << "}" << std::endl
-	                   << std::endl;
-
-	// client source
-	
-	protocol_client_cpp << "#include <array>" << std::endl
-	                   << "#include <functional>" << std::endl
-	                   << "#include <memory>" << std::endl
-	                   << "#include <string>" << std::endl
-	                   << "#include <vector>" << std::endl
-	                   << "#include <wayland-util.hpp>" << std::endl
-	                   << "#include <wayland-client-core.hpp>" << std::endl
-	                   << "#include <wayland-client-protocol.hpp>" << std::endl
-	                   << "#include <" << protocol.name << "-client-protocol.hpp>" << std::endl
-	                   << std::endl
-	                   << std::endl
-	                   << "namespace wayland {" << std::endl
-	                   << std::endl
-					   << "using namespace detail;" << std::endl
-	                   << std::endl;
-
-	// class member function definitions
-	for (auto &iface : interfaces) {
-		protocol_client_cpp << iface.print_memdef(CLIENT) << std::endl;
-	}
-
-	protocol_client_cpp << std::endl
-	                   << "}" << std::endl
-	                   << std::endl;
+	// member definitions, possibly split into several translation units
+	std::vector<std::string> server_sources, client_sources;
+	bool ok = write_sources(protocol, SERVER, src_dir, server_sources);
+	ok = write_sources(protocol, CLIENT, src_dir, client_sources) && ok;
 
 	// source intro
 	protocol_cpp << "#include <" << protocol.name << "-client-protocol.hpp>" << std::endl
@@ -1388,7 +1703,16 @@ int main(int argc, char *argv[]) {
 
 	// interface bodys
 	for (auto &iface : interfaces)
-		protocol_cpp << iface.print_common_defs(protocol.name);
+		iface.print_common_defs(protocol_cpp, protocol.name);
+
+	// interface table
+	protocol_cpp << "const interface_info_t wayland::detail::" << protocol.name
+	             << "_interfaces[" << interfaces.size() << "] = {" << std::endl;
+	for (auto &iface : interfaces)
+		protocol_cpp << "    { \"" << iface.orig_name << "\", " << iface.print_id()
+		             << ", &" << iface.name << "_interface }," << std::endl;
+	protocol_cpp << "};" << std::endl
+	             << std::endl;
 
 	// class member definitions
 	//for (auto &iface : interfaces)
@@ -1396,12 +1720,185 @@ int main(int argc, char *argv[]) {
 	//		protocol_cpp << iface.print_body() << std::endl;
 	//protocol_cpp << std::endl;
 
-	// clean up
-	protocol_client_hpp.close();
-	protocol_server_hpp.close();
-	protocol_client_cpp.close();
-	protocol_server_cpp.close();
-	protocol_cpp.close();
+	// manifest for src/*.mk, the common source goes into both libraries
+	std::string var_prefix = protocol.name;
+	for (auto &c : var_prefix) c = toupper(c);
+	output_file_t protocol_mk(src_dir + "/" + protocol.name + "-protocol.mk");
+	protocol_mk << "# generated by the scanner, lists the sources of " << protocol.name << std::endl
+	            << std::endl
+	            << var_prefix << "_SERVER_SRCS = \\" << std::endl;
+	for (auto &source : server_sources)
+		protocol_mk << "\t" << source << " \\" << std::endl;
+	protocol_mk << "\t" << protocol.name << "-protocol.cpp" << std::endl
+	            << std::endl
+	            << var_prefix << "_CLIENT_SRCS = \\" << std::endl;
+	for (auto &source : client_sources)
+		protocol_mk << "\t" << source << " \\" << std::endl;
+	protocol_mk << "\t" << protocol.name << "-protocol.cpp" << std::endl;
+
+	// clean up, unchanged files keep their timestamps
+	ok = protocol_client_hpp.commit() && ok;
+	ok = protocol_server_hpp.commit() && ok;
+	ok = protocol_cpp.commit() && ok;
+	ok = protocol_mk.commit() && ok;
+	return ok;
+}
+
+// runs job(0) ... job(count - 1) on up to 'threads' threads
+void parallel_for(unsigned int count, unsigned int threads, const std::function<void(unsigned int)> &job) {
+	std::atomic<unsigned int> next(0);
+	auto worker = [&] () {
+		for (unsigned int i = next++; i < count; i = next++)
+			job(i);
+	};
+	std::vector<std::thread> pool;
+	for (unsigned int c = 1; c < std::min(count, threads); c++)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
+/* Looks up the protocols defining the interfaces and enums each protocol
+   refers to but does not define itself. References nobody defines are
+   assumed to be core wayland, as they were before batch mode. */
+bool resolve_imports(std::vector<protocol_t> &protocols, bool warn) {
+	std::map<std::string, std::string> owners;
+	std::map<uint32_t, std::string> interface_ids;
+	for (auto &protocol : protocols) {
+		for (auto &iface : protocol.interfaces) {
+			owners[iface.name] = protocol.name;
+			// interface IDs are hashes, make sure they are unique
+			auto it = interface_ids.insert(std::make_pair(fnv1a(iface.orig_name), iface.orig_name));
+			if (!it.second) {
+				std::cerr << "Interface ID collision between " << it.first->second
+				          << " and " << iface.orig_name << std::endl;
+				return false;
+			}
+		}
+	}
+
+	for (auto &protocol : protocols) {
+		std::set<std::string> refs;
+		for (auto &iface : protocol.interfaces) {
+			for (auto &request : iface.requests)
+				for (auto &arg : request.args) {
+					refs.insert(arg.interface);
+					refs.insert(arg.enum_iface);
+				}
+			for (auto &event : iface.events)
+				for (auto &arg : event.args) {
+					refs.insert(arg.interface);
+					refs.insert(arg.enum_iface);
+				}
+		}
+		refs.erase("");
+
+		std::set<std::string> imports;
+		for (auto &ref : refs) {
+			auto owner = owners.find(ref);
+			if (owner != owners.end()) {
+				imports.insert(owner->second);
+			} else {
+				if (warn)
+					std::cerr << protocol.name << ": no protocol defines " << ref
+					          << ", assuming wayland" << std::endl;
+				imports.insert("wayland");
+			}
+		}
+		imports.erase(protocol.name);
+		protocol.imports.assign(imports.begin(), imports.end());
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	bool batch = false;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	int c = 1;
+	for (; c < argc && argv[c][0] == '-'; c++) {
+		std::string opt(argv[c]);
+		if (opt == "--handlers")
+			gen_handlers = true;
+		else if (opt == "--batch")
+			batch = true;
+		else if (opt == "--split")
+			source_shards = 0;
+		else if (opt == "--shards" && c + 1 < argc)
+			source_shards = std::max(1, std::atoi(argv[++c]));
+		else if (opt == "--min-version" && c + 1 < argc) {
+			std::string spec(argv[++c]);
+			size_t eq = spec.find('=');
+			if (eq == std::string::npos) {
+				std::cerr << "--min-version expects interface=version" << std::endl;
+				return 1;
+			}
+			min_versions[spec.substr(0, eq)] = std::atoi(spec.c_str() + eq + 1);
+		}
+		else if (opt == "--pool" && c + 1 < argc)
+			pooled_interfaces.insert(argv[++c]);
+		else if (opt == "-j" && c + 1 < argc)
+			threads = std::max(1, std::atoi(argv[++c]));
+		else
+			break;
+	}
+	if (argc - c < 3) {
+		std::cerr << "Usage:" << std::endl
+		          << "  " << argv[0] << " [options] protocol.xml inc_dir src_dir" << std::endl
+		          << "  " << argv[0] << " [options] --batch inc_dir src_dir protocol.xml..." << std::endl
+		          << "Options:" << std::endl
+		          << "  --handlers    also generate virtual handler classes" << std::endl
+		          << "  --split       one source file per interface" << std::endl
+		          << "  --shards N    N source files of about the same size" << std::endl
+		          << "  --min-version interface=N" << std::endl
+		          << "                skip version checks for messages up to version N" << std::endl
+		          << "  --pool interface" << std::endl
+		          << "                recycle the event tables of short-lived client objects" << std::endl
+		          << "  -j threads    threads to use in batch mode"
+				  //" server_header.hpp client_header.hpp source.cpp"
+		          << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> xml_files;
+	std::string inc_dir, src_dir;
+	if (batch) {
+		inc_dir = argv[c];
+		src_dir = argv[c + 1];
+		xml_files.assign(argv + c + 2, argv + argc);
+	} else {
+		xml_files.push_back(argv[c]);
+		inc_dir = argv[c + 1];
+		src_dir = argv[c + 2];
+	}
+
+	// every XML is parsed exactly once, all of them at the same time
+	std::vector<protocol_t> protocols(xml_files.size());
+	// not vector<bool>, the threads write neighbouring elements
+	std::vector<char> loaded(xml_files.size());
+	parallel_for(xml_files.size(), threads, [&] (unsigned int i) {
+		xml_document doc;
+		xml_parse_result result = doc.load_file(xml_files[i].c_str());
+		loaded[i] = result;
+		if (result)
+			protocols[i] = protocol_t(doc.child("protocol"));
+		else
+			std::cerr << xml_files[i] << ": " << result.description() << std::endl;
+	});
+	for (char ok : loaded)
+		if (!ok)
+			return 1;
+
+	if (!resolve_imports(protocols, batch))
+		return 1;
+
+	std::vector<char> written(protocols.size());
+	parallel_for(protocols.size(), threads, [&] (unsigned int i) {
+		written[i] = write_protocol(protocols[i], inc_dir, src_dir);
+	});
+	for (char ok : written)
+		if (!ok)
+			return 1;
 
 	return 0;
 }
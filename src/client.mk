@@ -2,6 +2,7 @@
 include ../defs.mk
 include ../functions.mk
 include ../rules.mk
+include wayland-protocol.mk
 
 TARGET = libwayland-client++.so
 
@@ -9,9 +10,9 @@ LIBS = wayland-client
 
 SRCS = \
 	wayland-client.cpp \
-	wayland-client-protocol.cpp \
-	wayland-protocol.cpp \
-	wayland-util.cpp
+	wayland-client-shm.cpp \
+	wayland-util.cpp \
+	$(WAYLAND_CLIENT_SRCS)
 
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
@@ -8,7 +8,8 @@ TARGET = libwayland-egl++.so
 LIBS = wayland-client++
 
 SRCS = \
-	wayland-egl.cpp
+	wayland-egl.cpp \
+	wayland-egl-surface.cpp
 
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
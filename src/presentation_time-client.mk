@@ -0,0 +1,20 @@
+
+include ../defs.mk
+include ../functions.mk
+include ../rules.mk
+include presentation_time-protocol.mk
+
+TARGET = libpresentation_time-client++.so
+
+LIBS = wayland-client++
+
+SRCS = \
+	wayland-client-presentation.cpp \
+	$(PRESENTATION_TIME_CLIENT_SRCS)
+
+
+$(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
+
+$(eval $(call print_vars,ALL_TARGETS))
+
+
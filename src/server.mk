@@ -2,6 +2,7 @@
 include ../defs.mk
 include ../functions.mk
 include ../rules.mk
+include wayland-protocol.mk
 
 TARGET = libwayland-server++.so
 
@@ -9,9 +10,8 @@ LIBS = wayland-server
 
 SRCS = \
 	wayland-server.cpp \
-	wayland-server-protocol.cpp \
-	wayland-protocol.cpp \
-	wayland-util.cpp
+	wayland-util.cpp \
+	$(WAYLAND_SERVER_SRCS)
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
 
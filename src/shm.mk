@@ -7,7 +7,8 @@ TARGET = libwayland-shm++.so
 LIBS = wayland-server++
 
 SRCS = \
-	wayland-shm.cpp
+	wayland-shm.cpp \
+	wayland-shm-convert.cpp
 
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
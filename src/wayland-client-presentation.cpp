@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <time.h>
+
+#include <wayland-client-presentation.hpp>
+
+using namespace wayland;
+
+presentation_tracker_t::presentation_tracker_t(wp_presentation_proxy_t presentation,
+                                               surface_proxy_t surface,
+                                               frame_scheduler_t *frames)
+	: presentation(presentation), surface(surface), frames(frames),
+	  clock(CLOCK_MONOTONIC), have_clock(false) {
+	this->presentation.on_clock_id() = [this](uint32_t clk_id) {
+		clock = clk_id;
+		have_clock = true;
+	};
+	if(frames)
+		frames->on_frame_request() = [this]() { request(); };
+}
+
+presentation_tracker_t::~presentation_tracker_t() {
+	if(frames)
+		frames->on_frame_request() = std::function<void()>();
+	presentation.on_clock_id() = std::function<void(uint32_t)>();
+}
+
+void presentation_tracker_t::request() {
+	in_flight.push_back(presentation.feedback(surface));
+	auto it = std::prev(in_flight.end());
+	it->on_presented() = [this, it](uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+	                                uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+	                                wp_presentation_feedback_kind flags) {
+		uint64_t sec = static_cast<uint64_t>(tv_sec_hi) << 32 | tv_sec_lo;
+		uint64_t seq = static_cast<uint64_t>(seq_hi) << 32 | seq_lo;
+		presented(it, sec * 1000000000 + tv_nsec, refresh, seq, flags);
+	};
+	it->on_discarded() = [this, it]() {
+		// the object is gone after the event
+		in_flight.erase(it);
+		if(discarded_handler)
+			discarded_handler();
+	};
+}
+
+void presentation_tracker_t::presented(std::list<wp_presentation_feedback_proxy_t>::iterator it,
+                                       uint64_t time, uint32_t refresh, uint64_t seq,
+                                       wp_presentation_feedback_kind flags) {
+	in_flight.erase(it);
+	if(frames && have_clock && clock == CLOCK_MONOTONIC)
+		frames->presented(time, refresh);
+	if(presented_handler)
+		presented_handler(time, refresh, seq, flags);
+}
+
+std::function<void(uint64_t, uint32_t, uint64_t, wp_presentation_feedback_kind)> &presentation_tracker_t::on_presented() {
+	return presented_handler;
+}
+
+std::function<void()> &presentation_tracker_t::on_discarded() {
+	return discarded_handler;
+}
+
+uint32_t presentation_tracker_t::get_clock() {
+	return clock;
+}
+
+bool presentation_tracker_t::has_clock() {
+	return have_clock;
+}
+
+unsigned int presentation_tracker_t::get_pending_count() {
+	return in_flight.size();
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <wayland-client-shm.hpp>
+
+using namespace wayland;
+
+// buffers start on cache line boundaries
+static const int32_t buffer_alignment = 64;
+static const int32_t min_pool_size = 4096;
+
+int wayland::detail::create_anonymous_file(int32_t size) {
+	int fd = -1;
+#ifdef MFD_CLOEXEC
+	fd = memfd_create("wayland-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		if (ftruncate(fd, size) < 0) {
+			close(fd);
+			throw std::runtime_error("ftruncate failed.");
+		}
+		// The compositor maps the file too, it must never shrink
+		// under it. Growing is what resize() is for.
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+		return fd;
+	}
+#endif
+
+	// no memfd, use an unlinked POSIX shared memory object
+	for (int retries = 0; retries < 100 && fd < 0; retries++) {
+		std::stringstream ss;
+		ss << "/wayland-shm-" << getpid() << "-" << rand();
+		fd = shm_open(ss.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0) {
+			shm_unlink(ss.str().c_str());
+		} else if (errno != EEXIST) {
+			break;
+		}
+	}
+	if (fd < 0) {
+		throw std::runtime_error("shm_open failed.");
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		throw std::runtime_error("ftruncate failed.");
+	}
+	return fd;
+}
+
+shm_pool_buffer_t::shm_pool_buffer_t()
+	: pool(NULL), slot(NULL) {
+}
+
+shm_pool_buffer_t::shm_pool_buffer_t(shm_buffer_pool_t *p, slot_t *s)
+	: pool(p), slot(s) {
+}
+
+shm_pool_buffer_t::operator bool() const {
+	return slot != NULL;
+}
+
+buffer_proxy_t &shm_pool_buffer_t::get_buffer() {
+	if (!slot) {
+		throw std::invalid_argument("shm_pool_buffer_t is empty");
+	}
+	return slot->buffer;
+}
+
+void *shm_pool_buffer_t::get_data() {
+	if (!slot) {
+		throw std::invalid_argument("shm_pool_buffer_t is empty");
+	}
+	return pool->data + slot->offset;
+}
+
+int32_t shm_pool_buffer_t::get_width() {
+	return slot ? slot->width : 0;
+}
+
+int32_t shm_pool_buffer_t::get_height() {
+	return slot ? slot->height : 0;
+}
+
+int32_t shm_pool_buffer_t::get_stride() {
+	return slot ? slot->stride : 0;
+}
+
+shm_format shm_pool_buffer_t::get_format() {
+	if (!slot) {
+		throw std::invalid_argument("shm_pool_buffer_t is empty");
+	}
+	return slot->format;
+}
+
+shm_buffer_pool_t::shm_buffer_pool_t(shm_proxy_t &shm, int32_t initial_size,
+		unsigned int max_bufs)
+	: fd(-1), data(NULL), size(std::max(initial_size, min_pool_size)),
+	max_buffers(std::max(max_bufs, 2u)) {
+	fd = detail::create_anonymous_file(size);
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		throw std::runtime_error("mmap failed.");
+	}
+	data = static_cast<uint8_t *>(p);
+	pool = shm.create_pool(fd, size);
+	free_ranges.push_back({ 0, size });
+}
+
+shm_buffer_pool_t::~shm_buffer_pool_t() {
+	for (auto &slot : slots) {
+		slot.buffer.on_release() = nullptr;
+	}
+	// destroys the wl_buffers before the wl_shm_pool
+	slots.clear();
+	munmap(data, size);
+	close(fd);
+}
+
+void shm_buffer_pool_t::grow(int32_t needed) {
+	int64_t new_size = std::max(static_cast<int64_t>(size) * 2,
+			static_cast<int64_t>(size) + needed);
+	new_size = (new_size + min_pool_size - 1) / min_pool_size * min_pool_size;
+	if (new_size > INT32_MAX) {
+		throw std::runtime_error("shm pool too large.");
+	}
+
+	if (ftruncate(fd, new_size) < 0) {
+		throw std::runtime_error("ftruncate failed.");
+	}
+	void *p = mremap(data, size, new_size, MREMAP_MAYMOVE);
+	if (p == MAP_FAILED) {
+		throw std::runtime_error("mremap failed.");
+	}
+	data = static_cast<uint8_t *>(p);
+	pool.resize(new_size);
+
+	free_range(size, new_size - size);
+	size = new_size;
+}
+
+bool shm_buffer_pool_t::allocate_range(int32_t needed, int32_t &offset) {
+	// first fit
+	for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+		if (it->size >= needed) {
+			offset = it->offset;
+			it->offset += needed;
+			it->size -= needed;
+			if (it->size == 0) {
+				free_ranges.erase(it);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void shm_buffer_pool_t::free_range(int32_t offset, int32_t len) {
+	// keep the list sorted and merge with the neighbours
+	auto next = free_ranges.begin();
+	while (next != free_ranges.end() && next->offset < offset) {
+		++next;
+	}
+	auto it = free_ranges.insert(next, { offset, len });
+	if (next != free_ranges.end() && it->offset + it->size == next->offset) {
+		it->size += next->size;
+		free_ranges.erase(next);
+	}
+	if (it != free_ranges.begin()) {
+		auto prev = std::prev(it);
+		if (prev->offset + prev->size == it->offset) {
+			prev->size += it->size;
+			free_ranges.erase(it);
+		}
+	}
+}
+
+void shm_buffer_pool_t::destroy_slot(std::list<shm_pool_buffer_t::slot_t>::iterator it) {
+	it->buffer.on_release() = nullptr;
+	free_range(it->offset, it->size);
+	slots.erase(it);
+}
+
+void shm_buffer_pool_t::release(shm_pool_buffer_t::slot_t *slot) {
+	slot->busy = false;
+}
+
+shm_pool_buffer_t shm_buffer_pool_t::acquire(int32_t width, int32_t height,
+		int32_t stride, shm_format format) {
+	if (width <= 0 || height <= 0
+			|| stride < static_cast<int64_t>(width) * detail::shm_format_bpp(static_cast<uint32_t>(format))) {
+		throw std::invalid_argument("invalid buffer size");
+	}
+
+	// planar 4:2:0 formats carry a half height chroma plane
+	int64_t rows = height;
+	if (format == shm_format::nv12 || format == shm_format::nv21) {
+		rows += (height + 1) / 2;
+	}
+	int64_t bytes = static_cast<int64_t>(stride) * rows;
+	bytes = (bytes + buffer_alignment - 1) / buffer_alignment * buffer_alignment;
+	if (bytes > INT32_MAX / 2) {
+		throw std::invalid_argument("buffer too large");
+	}
+
+	unsigned int count = 0;
+	for (auto it = slots.begin(); it != slots.end();) {
+		if (it->width == width && it->height == height
+				&& it->stride == stride && it->format == format) {
+			if (!it->busy) {
+				it->busy = true;
+				return shm_pool_buffer_t(this, &*it);
+			}
+			count++;
+			++it;
+		} else if (!it->busy) {
+			// left over from a previous size
+			destroy_slot(it++);
+		} else {
+			++it;
+		}
+	}
+
+	if (count >= max_buffers) {
+		return shm_pool_buffer_t();
+	}
+
+	int32_t offset;
+	if (!allocate_range(bytes, offset)) {
+		grow(bytes);
+		if (!allocate_range(bytes, offset)) {
+			throw std::runtime_error("shm pool allocation failed.");
+		}
+	}
+
+	slots.push_back({ buffer_proxy_t(), offset, static_cast<int32_t>(bytes),
+			width, height, stride, format, true });
+	shm_pool_buffer_t::slot_t *slot = &slots.back();
+	slot->buffer = pool.create_buffer(offset, width, height, stride, format);
+	slot->buffer.on_release() = [this, slot] () {
+		release(slot);
+	};
+	return shm_pool_buffer_t(this, slot);
+}
+
+unsigned int shm_buffer_pool_t::get_max_buffers() {
+	return max_buffers;
+}
+
+unsigned int shm_buffer_pool_t::get_busy_count() {
+	unsigned int count = 0;
+	for (auto &slot : slots) {
+		if (slot.busy) {
+			count++;
+		}
+	}
+	return count;
+}
+
+int32_t shm_buffer_pool_t::get_size() {
+	return size;
+}
@@ -25,6 +25,10 @@
  */
 
 #include <iostream>
+#include <new>
+#include <ctime>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include <wayland-client.hpp>
 //#include <wayland-client-protocol.hpp>
 
@@ -46,12 +50,22 @@ wl_event_queue *event_queue_t::c_ptr() {
 	return queue->queue;
 };
 
-proxy_t::proxy_data_t::proxy_data_t() : events(NULL) {
+proxy_t::proxy_data_t::proxy_data_t() : events(NULL), class_id(0), version(0) {
 }
 
 proxy_t::proxy_data_t::proxy_data_t(std::shared_ptr<events_base_t> ev,
 		int desop, unsigned int cnt)
-	: events(ev), destroy_opcode(desop), counter(cnt) {
+	: events(ev), destroy_opcode(desop), counter(cnt), class_id(0), version(0) {
+}
+
+proxy_t::proxy_data_t *proxy_t::proxy_data_t::create() {
+	void *p = block_pool_t<sizeof(proxy_data_t)>::instance().allocate();
+	return new (p) proxy_data_t(std::shared_ptr<events_base_t>(), -1, 0);
+}
+
+void proxy_t::proxy_data_t::release(proxy_data_t *data) {
+	data->~proxy_data_t();
+	block_pool_t<sizeof(proxy_data_t)>::instance().deallocate(data);
 }
 
 int proxy_t::c_dispatcher(const void *implementation, void *target, uint32_t opcode, const wl_message *message, wl_argument *args) {
@@ -136,14 +150,14 @@ int proxy_t::c_dispatcher(const void *implementation, void *target, uint32_t opc
 	return dispatcher(opcode, vargs, p.get_events());
 }
 
-proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, std::vector<argument_t> args) {
+proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, std::vector<argument_t> args, uint32_t version) {
 	std::vector<wl_argument> v;
 	for(auto &arg : args)
 		v.push_back(arg.argument);
 	if(interface) {
-		wl_proxy *p = wl_proxy_marshal_array_constructor(proxy, opcode, v.data(), interface);
+		wl_proxy *p = wl_proxy_marshal_array_constructor_versioned(proxy, opcode, v.data(), interface, version);
 		if(!p)
-			throw std::runtime_error("wl_proxy_marshal_array_constructor");
+			throw std::runtime_error("wl_proxy_marshal_array_constructor_versioned");
 		wl_proxy_set_user_data(p, NULL); // Wayland leaves the user data uninitialized
 		return proxy_t(p);
 	}
@@ -151,14 +165,14 @@ proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface,
 	return proxy_t();
 }
 
-proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, std::list<argument_t> args) {
+proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, std::list<argument_t> args, uint32_t version) {
 	std::vector<wl_argument> v;
 	for(auto &arg : args)
 		v.push_back(arg.argument);
 	if(interface) {
-		wl_proxy *p = wl_proxy_marshal_array_constructor(proxy, opcode, v.data(), interface);
+		wl_proxy *p = wl_proxy_marshal_array_constructor_versioned(proxy, opcode, v.data(), interface, version);
 		if(!p)
-			throw std::runtime_error("wl_proxy_marshal_array_constructor");
+			throw std::runtime_error("wl_proxy_marshal_array_constructor_versioned");
 		wl_proxy_set_user_data(p, NULL); // Wayland leaves the user data uninitialized
 		return proxy_t(p);
 	}
@@ -200,7 +214,7 @@ proxy_t::proxy_t(wl_proxy *p, bool is_display, bool donotdestroy)
 	if(!display) {
 		data = reinterpret_cast<proxy_data_t*>(wl_proxy_get_user_data(c_ptr()));
 		if(!data) {
-			data = new proxy_data_t{std::shared_ptr<events_base_t>(), -1, 0};
+			data = proxy_data_t::create();
 			wl_proxy_set_user_data(proxy, data);
 		}
 		data->counter++;
@@ -224,7 +238,7 @@ proxy_t &proxy_t::operator=(const proxy_t& p) {
 
 	if(!data) {
 		std::cerr << "Found proxy_t without meta data." << std::endl;
-		data = new proxy_data_t{std::shared_ptr<events_base_t>(), -1, 0};
+		data = proxy_data_t::create();
 		wl_proxy_set_user_data(proxy, data);
 	}
 	data->counter++;
@@ -258,7 +272,7 @@ proxy_t::~proxy_t() {
 				}
 				wl_proxy_destroy(proxy);
 			}
-			delete data;
+			proxy_data_t::release(data);
 		}
 	}
 }
@@ -268,9 +282,29 @@ uint32_t proxy_t::get_id() {
 }
 
 std::string proxy_t::get_class() {
+	return get_class_name();
+}
+
+const char *proxy_t::get_class_name() {
 	return wl_proxy_get_class(c_ptr());
 }
 
+interface_id_t proxy_t::get_class_id() {
+	if(display || !data)
+		return fnv1a(get_class_name());
+	if(!data->class_id)
+		data->class_id = fnv1a(get_class_name());
+	return data->class_id;
+}
+
+uint32_t proxy_t::get_version() {
+	if(display || !data)
+		return wl_proxy_get_version(c_ptr());
+	if(!data->version)
+		data->version = wl_proxy_get_version(c_ptr());
+	return data->version;
+}
+
 void proxy_t::set_queue(event_queue_t queue) {
 	wl_proxy_set_queue(c_ptr(), queue.c_ptr());
 }
@@ -379,3 +413,234 @@ int display_client_t::flush() {
 // registry_t display_client_t::get_registry() {
 // 	return registry_t(marshal_constructor(1, &registry_interface, NULL));
 // }
+
+registry_binder_t::entry_t::entry_t(proxy_t &t, uint32_t min, uint32_t max, bool req)
+	: target(&t), min_version(min), max_version(max), required(req) {
+	if(min_version > max_version)
+		throw std::invalid_argument("min_version > max_version");
+}
+
+uint32_t registry_binder_t::hash(const char *s, uint32_t seed) {
+	uint32_t h = detail::fnv1a(s, 2166136261u ^ (seed * 0x9e3779b9u));
+	return h ^ (h >> 16);
+}
+
+registry_binder_t::registry_binder_t(std::initializer_list<entry_t> entries)
+	: seed(0) {
+	for(auto &e : entries)
+		slots.push_back({ e, e.target->get_iface_ptr()->name, false });
+
+	for(unsigned int c = 0; c < slots.size(); c++)
+		for(unsigned int d = c + 1; d < slots.size(); d++)
+			if(slots[c].interface == slots[d].interface)
+				throw std::invalid_argument("duplicate interface " + slots[c].interface);
+
+	// find a seed that maps every interface to its own bucket,
+	// growing the table if none is found quickly. Done at run time,
+	// as the interfaces are only known from the target proxies.
+	size_t size = 1;
+	while(size < 2 * slots.size())
+		size <<= 1;
+	for(;;) {
+		for(seed = 0; seed < 64; seed++) {
+			table.assign(size, -1);
+			bool collision = false;
+			for(unsigned int c = 0; c < slots.size() && !collision; c++) {
+				int &bucket = table[hash(slots[c].interface.c_str(), seed) & (size - 1)];
+				if(bucket != -1)
+					collision = true;
+				bucket = c;
+			}
+			if(!collision)
+				return;
+		}
+		size <<= 1;
+	}
+}
+
+int registry_binder_t::lookup(const std::string &interface) {
+	int idx = table[hash(interface.c_str(), seed) & (table.size() - 1)];
+	if(idx == -1 || slots[idx].interface != interface)
+		return -1;
+	return idx;
+}
+
+void registry_binder_t::global(registry_proxy_t &registry, uint32_t name,
+                               const std::string &interface, uint32_t version) {
+	int idx = lookup(interface);
+	if(idx == -1)
+		return;
+	slot_t &slot = slots[idx];
+	if(slot.bound || version < slot.entry.min_version)
+		return;
+	registry.bind(name, *slot.entry.target, std::min(version, slot.entry.max_version));
+	slot.bound = true;
+}
+
+bool registry_binder_t::bind(display_client_t &display, registry_proxy_t &registry) {
+	for(auto &slot : slots)
+		slot.bound = false;
+
+	registry = display.get_registry();
+	registry_proxy_t *r = &registry;
+	registry.on_global() = [this, r](uint32_t name, std::string interface, uint32_t version) {
+		global(*r, name, interface, version);
+	};
+	int ret = display.roundtrip();
+	// globals announced later are left to the caller
+	registry.on_global() = nullptr;
+	if(ret < 0)
+		throw std::runtime_error("wl_display_roundtrip");
+
+	missing.clear();
+	for(auto &slot : slots)
+		if(slot.entry.required && !slot.bound)
+			missing.push_back(slot.interface);
+	return missing.empty();
+}
+
+const std::vector<std::string> &registry_binder_t::get_missing() {
+	return missing;
+}
+
+bool registry_binder_t::is_bound(const proxy_t &target) {
+	for(auto &slot : slots)
+		if(slot.entry.target == &target)
+			return slot.bound;
+	return false;
+}
+
+// assume 60 Hz until the first frame callbacks arrived
+static const uint64_t default_interval = 16667;
+
+static uint64_t monotonic_us() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+frame_scheduler_t::frame_scheduler_t(surface_proxy_t surface)
+	: surface(surface), pending(false), dirty(false), late_start(false),
+	  timer_armed(false), back_to_back(false), last_done(0), have_done(false),
+	  last_presented(0), have_presented(false), refresh_known(false),
+	  interval(default_interval), render_time(0), margin(4000) {
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if(timer_fd < 0)
+		throw std::runtime_error("timerfd_create failed.");
+}
+
+frame_scheduler_t::~frame_scheduler_t() {
+	close(timer_fd);
+}
+
+void frame_scheduler_t::schedule() {
+	dirty = true;
+	if(!pending && !timer_armed)
+		redraw(false);
+}
+
+void frame_scheduler_t::redraw(bool continued) {
+	back_to_back = continued;
+	dirty = false;
+	pending = true;
+	frame_cb = surface.frame();
+	frame_cb.on_done() = [this](uint32_t time) { done(time); };
+	if(frame_request_handler)
+		frame_request_handler();
+
+	uint64_t start = monotonic_us();
+	if(redraw_handler)
+		redraw_handler(predict_next_frame());
+	// smoothed, so a single slow frame doesn't make every start early
+	render_time = (render_time * 7 + (monotonic_us() - start)) / 8;
+}
+
+void frame_scheduler_t::done(uint32_t time) {
+	pending = false;
+	// only back to back frames say something about the refresh rate
+	if(have_done && back_to_back && !refresh_known) {
+		uint64_t delta = static_cast<uint32_t>(time - last_done) * 1000ull;
+		if(delta > 0 && delta < 1000000)
+			interval = (interval * 7 + delta) / 8;
+	}
+	last_done = time;
+	have_done = true;
+
+	if(!dirty)
+		return;
+
+	uint64_t budget = render_time + margin;
+	if(!late_start || budget >= interval) {
+		redraw(true);
+		return;
+	}
+
+	uint64_t delay = interval - budget;
+	if(have_presented) {
+		// aim at the next refresh instead of a frame after the done event
+		uint64_t now = monotonic_us();
+		uint64_t next = last_presented / 1000 + interval;
+		// a zero delay would disarm the timer
+		while(next <= now + budget)
+			next += interval;
+		delay = next - budget - now;
+	}
+	itimerspec its = { { 0, 0 }, { static_cast<time_t>(delay / 1000000), static_cast<long>(delay % 1000000) * 1000 } };
+	timerfd_settime(timer_fd, 0, &its, NULL);
+	timer_armed = true;
+}
+
+std::function<void(uint32_t)> &frame_scheduler_t::on_redraw() {
+	return redraw_handler;
+}
+
+std::function<void()> &frame_scheduler_t::on_frame_request() {
+	return frame_request_handler;
+}
+
+void frame_scheduler_t::presented(uint64_t time, uint32_t refresh) {
+	if(refresh > 0 && refresh < 1000000000) {
+		interval = (refresh + 500) / 1000;
+		refresh_known = true;
+	}
+	last_presented = time;
+	have_presented = true;
+}
+
+void frame_scheduler_t::set_late_start(bool enable, uint32_t safety_margin) {
+	late_start = enable;
+	margin = safety_margin;
+}
+
+int frame_scheduler_t::get_fd() {
+	return timer_fd;
+}
+
+void frame_scheduler_t::dispatch() {
+	uint64_t expirations;
+	if(read(timer_fd, &expirations, sizeof(expirations)) < 0)
+		return;
+	timer_armed = false;
+	if(dirty && !pending)
+		redraw(true);
+}
+
+bool frame_scheduler_t::is_pending() {
+	return pending;
+}
+
+uint32_t frame_scheduler_t::get_refresh_interval() {
+	return interval;
+}
+
+uint32_t frame_scheduler_t::predict_next_frame() {
+	if(!have_done)
+		return 0;
+	return last_done + static_cast<uint32_t>(interval / 1000);
+}
+
+uint64_t frame_scheduler_t::predict_next_presentation() {
+	if(!have_presented)
+		return 0;
+	return last_presented + interval * 1000;
+}
@@ -24,91 +24,573 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <wayland-cursor.hpp>
+#include <wayland-client-shm.hpp>
 
 using namespace wayland;
 
-cursor_theme_t::cursor_theme_ptr::~cursor_theme_ptr() {
-	wl_cursor_theme_destroy(cursor_theme);
+// Xcursor file format
+static const uint32_t xcursor_magic = 0x72756358; // "Xcur"
+static const uint32_t xcursor_image_type = 0xfffd0002;
+static const uint32_t xcursor_max_size = 0x7fff;
+static const unsigned int max_inherit_depth = 16;
+
+static const int32_t min_pool_size = 16 * 1024;
+
+// names that stand for the same cursor, the first match wins
+static const char *const cursor_aliases[][5] = {
+	{ "left_ptr", "default", "arrow", "top_left_arrow", NULL },
+	{ "text", "xterm", "ibeam", NULL },
+	{ "pointer", "hand2", "hand1", "pointing_hand", NULL },
+	{ "wait", "watch", NULL },
+	{ "progress", "left_ptr_watch", "half-busy", NULL },
+	{ "crosshair", "cross", "tcross", NULL },
+	{ "grabbing", "fleur", "closedhand", NULL },
+	{ "grab", "openhand", "hand1", NULL },
+	{ "move", "fleur", NULL },
+	{ "not-allowed", "crossed_circle", "forbidden", NULL },
+	{ "help", "question_arrow", "whats_this", NULL },
+	{ "n-resize", "top_side", NULL },
+	{ "s-resize", "bottom_side", NULL },
+	{ "e-resize", "right_side", NULL },
+	{ "w-resize", "left_side", NULL },
+	{ "ne-resize", "top_right_corner", NULL },
+	{ "nw-resize", "top_left_corner", NULL },
+	{ "se-resize", "bottom_right_corner", NULL },
+	{ "sw-resize", "bottom_left_corner", NULL },
+	{ "ns-resize", "sb_v_double_arrow", "v_double_arrow", NULL },
+	{ "ew-resize", "sb_h_double_arrow", "h_double_arrow", NULL },
+};
+
+static std::vector<std::string> get_aliases(const std::string &name) {
+	std::vector<std::string> names(1, name);
+	for(auto &group : cursor_aliases) {
+		bool found = false;
+		for(unsigned int c = 0; group[c] && !found; c++)
+			found = name == group[c];
+		if(!found)
+			continue;
+		for(unsigned int c = 0; group[c]; c++)
+			if(name != group[c])
+				names.push_back(group[c]);
+	}
+	return names;
+}
+
+static std::vector<std::string> get_search_path() {
+	const char *env = getenv("XCURSOR_PATH");
+	std::string path = env ? env : "~/.local/share/icons:~/.icons:/usr/share/icons:/usr/share/pixmaps";
+	const char *home = getenv("HOME");
+
+	std::vector<std::string> dirs;
+	std::stringstream ss(path);
+	std::string dir;
+	while(std::getline(ss, dir, ':')) {
+		if(dir.empty())
+			continue;
+		if(dir[0] == '~') {
+			if(!home)
+				continue;
+			dir = home + dir.substr(1);
+		}
+		dirs.push_back(dir);
+	}
+	return dirs;
+}
+
+static std::vector<std::string> get_inherits(const std::string &file) {
+	std::vector<std::string> themes;
+	std::ifstream in(file);
+	std::string line;
+	while(std::getline(in, line)) {
+		if(line.compare(0, 8, "Inherits") != 0)
+			continue;
+		size_t eq = line.find('=');
+		if(eq == std::string::npos)
+			continue;
+		std::string list = line.substr(eq + 1);
+		for(char &c : list)
+			if(c == ',' || c == ';' || c == '\t')
+				c = ' ';
+		std::stringstream ss(list);
+		std::string theme;
+		while(ss >> theme)
+			themes.push_back(theme);
+		break;
+	}
+	return themes;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
 }
 
+struct cursor_theme_t::theme_data_t {
+	std::string name;
+	int size;
+	shm_proxy_t shm;
+
+	// cursor name -> Xcursor file, built on first use
+	bool indexed;
+	std::unordered_map<std::string, std::string> index;
+	// requested name -> loaded cursor
+	std::unordered_map<std::string, cursor_t> cache;
+
+	// pool shared by all cursor images of the theme
+	shm_pool_proxy_t pool;
+	int fd;
+	uint8_t *data;
+	int32_t pool_size;
+	int32_t pool_used;
+
+	std::shared_ptr<wl_cursor_theme> fallback;
+	bool fallback_loaded;
+
+	theme_data_t(std::string n, int s, shm_proxy_t sh)
+		: name(n), size(s), shm(sh), indexed(false),
+		  fd(-1), data(NULL), pool_size(0), pool_used(0),
+		  fallback_loaded(false) {
+	}
+
+	~theme_data_t() {
+		if(data)
+			munmap(data, pool_size);
+		if(fd >= 0)
+			close(fd);
+	}
+
+	// returns the offset of bytes fresh bytes in the pool
+	int32_t alloc(int32_t bytes) {
+		if(!data) {
+			int32_t new_size = std::max(bytes, min_pool_size);
+			fd = detail::create_anonymous_file(new_size);
+			void *p = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(p == MAP_FAILED)
+				throw std::runtime_error("mmap failed.");
+			data = static_cast<uint8_t *>(p);
+			pool_size = new_size;
+			pool = shm.create_pool(fd, pool_size);
+		} else if(pool_size - pool_used < bytes) {
+			int64_t new_size = std::max(static_cast<int64_t>(pool_size) * 2,
+			                            static_cast<int64_t>(pool_used) + bytes);
+			if(new_size > INT32_MAX)
+				throw std::runtime_error("Cursor pool too large.");
+			if(ftruncate(fd, new_size) < 0)
+				throw std::runtime_error("ftruncate failed.");
+			void *p = mremap(data, pool_size, new_size, MREMAP_MAYMOVE);
+			if(p == MAP_FAILED)
+				throw std::runtime_error("mremap failed.");
+			data = static_cast<uint8_t *>(p);
+			pool_size = new_size;
+			pool.resize(pool_size);
+		}
+		int32_t offset = pool_used;
+		pool_used += bytes;
+		return offset;
+	}
+};
+
 cursor_theme_t::cursor_theme_t() {
 }
 
 cursor_theme_t::cursor_theme_t(std::string name, int size, shm_proxy_t shm)
-	: cursor_theme(new cursor_theme_ptr( {
-	wl_cursor_theme_load(name == "" ? NULL : name.c_str(),
-	                     size, reinterpret_cast<wl_shm*>(shm.c_ptr()))
-})) {
-	if(!cursor_theme->cursor_theme)
-		throw std::runtime_error("wl_cursor_theme_load failed.");
+	: theme(new theme_data_t(name == "" ? "default" : name, size, shm)) {
 }
 
-cursor_t cursor_theme_t::get_cursor(std::string name) {
-	wl_cursor *cursor = wl_cursor_theme_get_cursor(cursor_theme->cursor_theme, name.c_str());
-	if(!cursor)
-		throw std::runtime_error("wl_cursor_theme_cursor failed.");
+void cursor_theme_t::build_index() {
+	theme->indexed = true;
+	std::vector<std::string> dirs = get_search_path();
+
+	// breadth first over the inheritance graph, earlier themes win
+	std::vector<std::string> themes(1, theme->name);
+	for(unsigned int t = 0; t < themes.size() && t < max_inherit_depth; t++) {
+		for(auto &dir : dirs) {
+			std::string cursors = dir + "/" + themes[t] + "/cursors";
+			DIR *d = opendir(cursors.c_str());
+			if(!d)
+				continue;
+			while(dirent *e = readdir(d)) {
+				if(e->d_name[0] == '.')
+					continue;
+				theme->index.insert(std::make_pair(std::string(e->d_name), cursors + "/" + e->d_name));
+			}
+			closedir(d);
+		}
+		for(auto &dir : dirs) {
+			for(auto &inherit : get_inherits(dir + "/" + themes[t] + "/index.theme"))
+				if(std::find(themes.begin(), themes.end(), inherit) == themes.end())
+					themes.push_back(inherit);
+		}
+	}
+}
+
+cursor_t cursor_theme_t::load_file(const std::string &name, const std::string &path) {
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)),
+	                          std::istreambuf_iterator<char>());
+	if(file.size() < 16 || read_le32(&file[0]) != xcursor_magic)
+		return cursor_t();
+
+	uint32_t header = read_le32(&file[4]);
+	uint32_t ntoc = read_le32(&file[12]);
+	if(header < 16 || header > file.size() || ntoc > (file.size() - header) / 12)
+		return cursor_t();
+
+	// pick the nominal size closest to the requested one
+	uint32_t best = 0;
+	for(uint32_t c = 0; c < ntoc; c++) {
+		const uint8_t *toc = &file[header + c * 12];
+		if(read_le32(toc) != xcursor_image_type)
+			continue;
+		uint32_t subtype = read_le32(toc + 4);
+		if(!best || std::abs(static_cast<int>(subtype) - theme->size)
+		   < std::abs(static_cast<int>(best) - theme->size))
+			best = subtype;
+	}
+	if(!best)
+		return cursor_t();
+
+	std::shared_ptr<cursor_t::cursor_data_t> cursor(new cursor_t::cursor_data_t);
+	cursor->name = name;
+	cursor->total_delay = 0;
+	for(uint32_t c = 0; c < ntoc; c++) {
+		const uint8_t *toc = &file[header + c * 12];
+		if(read_le32(toc) != xcursor_image_type || read_le32(toc + 4) != best)
+			continue;
+		uint32_t pos = read_le32(toc + 8);
+		if(pos > file.size() || file.size() - pos < 36)
+			return cursor_t();
+		const uint8_t *chunk = &file[pos];
+		uint32_t width = read_le32(chunk + 16);
+		uint32_t height = read_le32(chunk + 20);
+		if(width == 0 || height == 0 || width > xcursor_max_size || height > xcursor_max_size
+		   || (file.size() - pos - 36) / 4 / width < height)
+			return cursor_t();
+
+		// Xcursor pixels are premultiplied ARGB words, the same as
+		// wl_shm's argb8888
+		int32_t bytes = width * height * 4;
+		int32_t offset = theme->alloc(bytes);
+		const uint8_t *src = chunk + 36;
+		uint32_t *dst = reinterpret_cast<uint32_t *>(theme->data + offset);
+		for(uint32_t p = 0; p < width * height; p++)
+			dst[p] = read_le32(src + p * 4);
+
+		std::shared_ptr<cursor_image_t::image_data_t> image(new cursor_image_t::image_data_t);
+		image->width = width;
+		image->height = height;
+		image->hotspot_x = std::min(read_le32(chunk + 24), width - 1);
+		image->hotspot_y = std::min(read_le32(chunk + 28), height - 1);
+		image->delay = read_le32(chunk + 32);
+		image->buffer = theme->pool.create_buffer(offset, width, height, width * 4, shm_format::argb8888);
+		cursor->total_delay += image->delay;
+		cursor->images.push_back(cursor_image_t(image));
+	}
+	return cursor_t(cursor);
+}
+
+cursor_t cursor_theme_t::load_fallback(const std::string &name) {
+	if(!theme->fallback_loaded) {
+		theme->fallback_loaded = true;
+		wl_cursor_theme *t = wl_cursor_theme_load(theme->name.c_str(), theme->size,
+		                                          reinterpret_cast<wl_shm*>(theme->shm.c_ptr()));
+		if(t)
+			theme->fallback = std::shared_ptr<wl_cursor_theme>(t, wl_cursor_theme_destroy);
+	}
+	if(!theme->fallback)
+		return cursor_t();
+
+	wl_cursor *c = wl_cursor_theme_get_cursor(theme->fallback.get(), name.c_str());
+	if(!c)
+		return cursor_t();
+
+	std::shared_ptr<cursor_t::cursor_data_t> cursor(new cursor_t::cursor_data_t);
+	cursor->name = c->name;
+	cursor->total_delay = 0;
+	for(unsigned int n = 0; n < c->image_count; n++) {
+		wl_cursor_image *img = c->images[n];
+		wl_proxy *proxy = reinterpret_cast<wl_proxy*>(wl_cursor_image_get_buffer(img));
+		wl_proxy_set_user_data(proxy, NULL);
+
+		std::shared_ptr<cursor_image_t::image_data_t> image(new cursor_image_t::image_data_t);
+		image->width = img->width;
+		image->height = img->height;
+		image->hotspot_x = img->hotspot_x;
+		image->hotspot_y = img->hotspot_y;
+		image->delay = img->delay;
+		// buffer will be destroyed when the fallback theme is destroyed
+		image->buffer = buffer_proxy_t(proxy_t(proxy, false, true));
+		image->owner = theme->fallback;
+		cursor->total_delay += image->delay;
+		cursor->images.push_back(cursor_image_t(image));
+	}
 	return cursor_t(cursor);
 }
 
-cursor_t::cursor_t(wl_cursor *c)
-	: cursor(c) {
+cursor_t cursor_theme_t::get_cursor(std::string name) {
+	if(!theme)
+		throw std::runtime_error("Cursor theme not loaded.");
+
+	auto cached = theme->cache.find(name);
+	if(cached != theme->cache.end())
+		return cached->second;
+
+	if(!theme->indexed)
+		build_index();
+
+	std::vector<std::string> names = get_aliases(name);
+	cursor_t cursor;
+	for(auto &n : names) {
+		auto file = theme->index.find(n);
+		if(file != theme->index.end()) {
+			cursor = load_file(n, file->second);
+			if(cursor.data)
+				break;
+		}
+	}
+	for(unsigned int c = 0; c < names.size() && !cursor.data; c++)
+		cursor = load_fallback(names[c]);
+	if(!cursor.data)
+		throw std::runtime_error("Cursor " + name + " not found.");
+
+	theme->cache[name] = cursor;
+	return cursor;
 }
 
-cursor_t::cursor_t()
-	: cursor(NULL) {
+cursor_t::cursor_t(std::shared_ptr<cursor_data_t> d)
+	: data(d) {
+}
+
+cursor_t::cursor_t() {
 }
 
 unsigned int cursor_t::image_count() {
-	return cursor->image_count;
+	return data->images.size();
 }
 
 std::string cursor_t::name() {
-	return cursor->name;
+	return data->name;
 }
 
 cursor_image_t cursor_t::image(unsigned int n) {
 	if(n >= image_count())
 		throw std::runtime_error("n >= image count");
-	return cursor_image_t(cursor->images[n]);
+	return data->images[n];
 }
 
 int cursor_t::frame(uint32_t time) {
-	return wl_cursor_frame(cursor, time);
+	uint32_t duration;
+	return frame_and_duration(time, duration);
+}
+
+int cursor_t::frame_and_duration(uint32_t time, uint32_t &duration) {
+	std::vector<cursor_image_t> &images = data->images;
+	if(images.size() <= 1 || data->total_delay == 0) {
+		duration = 0;
+		return 0;
+	}
+
+	uint32_t t = time % data->total_delay;
+	unsigned int n = 0;
+	while(n + 1 < images.size() && t >= images[n].delay()) {
+		t -= images[n].delay();
+		n++;
+	}
+	// never report a static frame for an animated cursor
+	duration = t >= images[n].delay() ? 1 : images[n].delay() - t;
+	return n;
 }
 
-cursor_image_t::cursor_image_t(wl_cursor_image *image)
-	: cursor_image(image) {
+cursor_image_t::cursor_image_t(std::shared_ptr<image_data_t> d)
+	: data(d) {
 }
 
-cursor_image_t::cursor_image_t()
-	: cursor_image(NULL) {
+cursor_image_t::cursor_image_t() {
 }
 
 uint32_t cursor_image_t::width() {
-	return cursor_image->width;
+	return data->width;
 }
 
 uint32_t cursor_image_t::height() {
-	return cursor_image->height;
+	return data->height;
 }
 
 uint32_t cursor_image_t::hotspot_x() {
-	return cursor_image->hotspot_x;
+	return data->hotspot_x;
 }
 
 uint32_t cursor_image_t::hotspot_y() {
-	return cursor_image->hotspot_y;
+	return data->hotspot_y;
 }
 
 uint32_t cursor_image_t::delay() {
-	return cursor_image->delay;
+	return data->delay;
 }
 
 buffer_proxy_t cursor_image_t::get_buffer() {
-	wl_buffer *buffer = wl_cursor_image_get_buffer(cursor_image);
-	wl_proxy *proxy = reinterpret_cast<wl_proxy*>(buffer);
-	wl_proxy_set_user_data(proxy, NULL);
-	// buffer will be destroyed when cursor_theme is destroyed
-	return buffer_proxy_t(proxy_t(proxy, false, true));
+	return data->buffer;
+}
+
+static uint64_t now_ms() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+cursor_manager_t::cursor_manager_t(compositor_proxy_t compositor, shm_proxy_t shm,
+                                   std::string theme, int size)
+	: shm(shm), theme_name(theme), size(size), scale(1),
+	  has_pointer(false), serial(0), hidden(true),
+	  current_frame(-1), hotspot_x(0), hotspot_y(0), anim_start(0) {
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if(timer_fd < 0)
+		throw std::runtime_error("timerfd_create failed.");
+	surface = compositor.create_surface();
+}
+
+cursor_manager_t::~cursor_manager_t() {
+	close(timer_fd);
+}
+
+std::shared_ptr<cursor_manager_t::cursor_entry_t> cursor_manager_t::load(const std::string &name) {
+	auto t = themes.find(scale);
+	if(t == themes.end()) {
+		theme_entry_t entry;
+		entry.theme = cursor_theme_t(theme_name, size * scale, shm);
+		t = themes.insert(std::make_pair(scale, entry)).first;
+	}
+
+	auto &cursors = t->second.cursors;
+	auto c = cursors.find(name);
+	if(c != cursors.end())
+		return c->second;
+
+	std::shared_ptr<cursor_entry_t> entry(new cursor_entry_t);
+	entry->name = name;
+	entry->cursor = t->second.theme.get_cursor(name);
+	for(unsigned int n = 0; n < entry->cursor.image_count(); n++) {
+		cursor_image_t image = entry->cursor.image(n);
+		entry->frames.push_back({ image.get_buffer(),
+		                          static_cast<int32_t>(image.width()),
+		                          static_cast<int32_t>(image.height()),
+		                          static_cast<int32_t>(image.hotspot_x()),
+		                          static_cast<int32_t>(image.hotspot_y()) });
+	}
+	cursors[name] = entry;
+	return entry;
+}
+
+bool cursor_manager_t::preload(std::string name) {
+	try {
+		load(name);
+	} catch(std::runtime_error &) {
+		return false;
+	}
+	return true;
+}
+
+void cursor_manager_t::show_frame(unsigned int n) {
+	frame_t &f = current->frames.at(n);
+	surface.attach(f.buffer, 0, 0);
+	surface.damage(0, 0, (f.width + scale - 1) / scale, (f.height + scale - 1) / scale);
+	surface.commit();
+	current_frame = n;
+
+	// the hotspot is given in surface coordinates
+	int32_t hx = f.hotspot_x / scale;
+	int32_t hy = f.hotspot_y / scale;
+	if(has_pointer && (hidden || hx != hotspot_x || hy != hotspot_y)) {
+		pointer.set_cursor(serial, surface, hx, hy);
+		hidden = false;
+	}
+	hotspot_x = hx;
+	hotspot_y = hy;
+}
+
+void cursor_manager_t::update() {
+	if(!current)
+		return;
+
+	uint32_t duration = 0;
+	int n = 0;
+	if(current->frames.size() > 1)
+		n = current->cursor.frame_and_duration(static_cast<uint32_t>(now_ms() - anim_start), duration);
+	if(n != current_frame)
+		show_frame(n);
+	arm_timer(duration);
+}
+
+void cursor_manager_t::arm_timer(uint32_t ms) {
+	itimerspec its = { { 0, 0 }, { ms / 1000, static_cast<long>(ms % 1000) * 1000000 } };
+	timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+void cursor_manager_t::set_scale(int s) {
+	if(s < 1 || s == scale)
+		return;
+	scale = s;
+	if(surface.get_version() >= 3)
+		surface.set_buffer_scale(scale);
+	if(current) {
+		current = load(current->name);
+		current_frame = -1;
+		update();
+	}
+}
+
+void cursor_manager_t::set_cursor(pointer_proxy_t p, uint32_t s, std::string name) {
+	bool same_pointer = has_pointer && pointer.c_ptr() == p.c_ptr();
+	if(current && current->name == name && !hidden && same_pointer && s == serial)
+		return;
+
+	pointer = p;
+	has_pointer = true;
+	serial = s;
+	if(!current || current->name != name) {
+		current = load(name);
+		current_frame = -1;
+		anim_start = now_ms();
+		hidden = true;
+		update();
+	} else {
+		// e.g. a new enter: the surface contents are still valid
+		bool was_hidden = hidden;
+		pointer.set_cursor(serial, surface, hotspot_x, hotspot_y);
+		hidden = false;
+		if(was_hidden)
+			update();
+	}
+}
+
+void cursor_manager_t::hide(pointer_proxy_t p, uint32_t s) {
+	p.set_cursor(s, surface_proxy_t(), 0, 0);
+	hidden = true;
+	arm_timer(0);
+}
+
+int cursor_manager_t::get_fd() {
+	return timer_fd;
+}
+
+void cursor_manager_t::dispatch() {
+	uint64_t expirations;
+	if(read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN)
+		return;
+	if(!hidden)
+		update();
 }
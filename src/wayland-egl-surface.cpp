@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <wayland-egl-surface.hpp>
+#include <EGL/eglext.h>
+
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
+using namespace wayland;
+
+// frames of damage history kept for buffer age
+static const unsigned int max_buffer_age = 4;
+
+static bool has_extension(const char *extensions, const char *name) {
+	size_t len = strlen(name);
+	const char *p = extensions;
+	while(extensions && (p = strstr(p, name))) {
+		if((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+	return false;
+}
+
+egl_surface_t::egl_surface_t(EGLDisplay display, EGLConfig config,
+                             surface_proxy_t &surface, int width, int height)
+	: display(display), window(surface, width, height), surface(surface),
+	  width(width), height(height), swap_with_damage(NULL), frame_pending(false) {
+	egl_surface = eglCreateWindowSurface(display, config, window, NULL);
+	if(egl_surface == EGL_NO_SURFACE)
+		throw std::runtime_error("eglCreateWindowSurface");
+
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	has_buffer_age = has_extension(extensions, "EGL_EXT_buffer_age");
+	if(has_extension(extensions, "EGL_KHR_swap_buffers_with_damage"))
+		swap_with_damage = reinterpret_cast<swap_with_damage_t>(eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+	if(!swap_with_damage && has_extension(extensions, "EGL_EXT_swap_buffers_with_damage"))
+		swap_with_damage = reinterpret_cast<swap_with_damage_t>(eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+}
+
+egl_surface_t::~egl_surface_t() {
+	eglDestroySurface(display, egl_surface);
+}
+
+void egl_surface_t::make_current(EGLContext context) {
+	if(eglMakeCurrent(display, egl_surface, egl_surface, context) == EGL_FALSE)
+		throw std::runtime_error("eglMakeCurrent");
+	// frame callbacks pace the client, swapping must not block
+	eglSwapInterval(display, 0);
+}
+
+void egl_surface_t::resize(int w, int h) {
+	if(w == width && h == height)
+		return;
+	width = w;
+	height = h;
+	window.resize(width, height);
+	history.clear();
+}
+
+int egl_surface_t::get_width() {
+	return width;
+}
+
+int egl_surface_t::get_height() {
+	return height;
+}
+
+int egl_surface_t::get_buffer_age() {
+	if(!has_buffer_age)
+		return 0;
+	EGLint age = 0;
+	if(eglQuerySurface(display, egl_surface, EGL_BUFFER_AGE_EXT, &age) == EGL_FALSE)
+		return 0;
+	return age;
+}
+
+std::vector<egl_rect_t> egl_surface_t::get_repaint_region(const std::vector<egl_rect_t> &damage) {
+	int age = get_buffer_age();
+	// age 1 is the buffer swapped last, which only misses this frame
+	if(age == 0 || static_cast<unsigned int>(age - 1) > history.size())
+		return std::vector<egl_rect_t>(1, egl_rect_t{ 0, 0, width, height });
+
+	std::vector<egl_rect_t> region(damage);
+	for(int c = 0; c < age - 1; c++)
+		region.insert(region.end(), history[c].begin(), history[c].end());
+	return region;
+}
+
+void egl_surface_t::swap_buffers(const std::vector<egl_rect_t> &damage) {
+	if(damage.empty())
+		history.push_front(std::vector<egl_rect_t>(1, egl_rect_t{ 0, 0, width, height }));
+	else
+		history.push_front(damage);
+	if(history.size() > max_buffer_age)
+		history.pop_back();
+
+	frame_pending = true;
+	frame_cb = surface.frame();
+	frame_cb.on_done() = [this](uint32_t time) {
+		frame_pending = false;
+		if(frame_handler)
+			frame_handler(time);
+	};
+
+	if(!swap_with_damage || damage.empty()) {
+		if(eglSwapBuffers(display, egl_surface) == EGL_FALSE)
+			throw std::runtime_error("eglSwapBuffers");
+		return;
+	}
+
+	// EGL rectangles have their origin at the bottom left
+	std::vector<EGLint> rects;
+	rects.reserve(damage.size() * 4);
+	for(auto &r : damage) {
+		rects.push_back(r.x);
+		rects.push_back(height - r.y - r.height);
+		rects.push_back(r.width);
+		rects.push_back(r.height);
+	}
+	if(swap_with_damage(display, egl_surface, rects.data(), damage.size()) == EGL_FALSE)
+		throw std::runtime_error("eglSwapBuffersWithDamage");
+}
+
+bool egl_surface_t::is_frame_pending() {
+	return frame_pending;
+}
+
+std::function<void(uint32_t)> &egl_surface_t::on_frame() {
+	return frame_handler;
+}
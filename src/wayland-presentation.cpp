@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <wayland-presentation.hpp>
+
+using namespace wayland;
+
+presentation_t::presentation_t(display_server_t &display, clockid_t clock)
+	: global_t(display, detail::wp_presentation_interface, 1, this, NULL),
+	  clock(clock) {
+}
+
+void presentation_t::bind(resource_t res, void *data) {
+	resources.push_back(wp_presentation_resource_t(res));
+	auto it = std::prev(resources.end());
+
+	it->on_destroy() = [it]() {
+		it->destroy();
+	};
+	it->on_feedback() = [this](surface_resource_t surface, wp_presentation_feedback_resource_t feedback) {
+		if(feedback_handler)
+			feedback_handler(surface, feedback);
+		else {
+			feedback.send_discarded();
+			feedback.destroy();
+		}
+	};
+	// runs for the destroy request as well as for gone clients
+	it->add_destroy_listener([this, it]() {
+		resources.erase(it);
+	});
+	it->send_clock_id(clock);
+}
+
+clockid_t presentation_t::get_clock() {
+	return clock;
+}
+
+std::function<void(surface_resource_t, wp_presentation_feedback_resource_t)> &presentation_t::on_feedback() {
+	return feedback_handler;
+}
+
+void presentation_feedback_list_t::add(wp_presentation_feedback_resource_t feedback) {
+	feedbacks.push_back(feedback);
+}
+
+void presentation_feedback_list_t::append(presentation_feedback_list_t &other) {
+	feedbacks.insert(feedbacks.end(), other.feedbacks.begin(), other.feedbacks.end());
+	other.feedbacks.clear();
+}
+
+bool presentation_feedback_list_t::empty() {
+	return feedbacks.empty();
+}
+
+void presentation_feedback_list_t::presented(uint64_t time, uint32_t refresh, uint64_t seq,
+                                             wp_presentation_feedback_kind flags,
+                                             const std::vector<output_resource_t> &outputs) {
+	uint64_t sec = time / 1000000000;
+	uint32_t nsec = time % 1000000000;
+	for(auto &feedback : feedbacks) {
+		// the client may be gone already
+		if(feedback.is_destroyed())
+			continue;
+		for(auto output : outputs)
+			if(!output.is_destroyed() && output.get_client() == feedback.get_client())
+				feedback.send_sync_output(output);
+		feedback.send_presented(sec >> 32, sec & 0xffffffff, nsec, refresh,
+		                        seq >> 32, seq & 0xffffffff, flags);
+		feedback.destroy();
+	}
+	// keeps its capacity for the next frame
+	feedbacks.clear();
+}
+
+void presentation_feedback_list_t::discarded() {
+	for(auto &feedback : feedbacks) {
+		if(feedback.is_destroyed())
+			continue;
+		feedback.send_discarded();
+		feedback.destroy();
+	}
+	feedbacks.clear();
+}
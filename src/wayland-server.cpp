@@ -29,6 +29,7 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <new>
 #include <wayland-server.h>
 #include <wayland-server.hpp>
 //#include <wayland-server-protocol.hpp>
@@ -148,19 +149,24 @@ resource_t::resource_t(wl_resource *p, bool is_display, bool donotdestroy)
 		// check implementation
 		data = reinterpret_cast<resource_data_t*>(wl_resource_get_user_data(c_ptr()));
 		if(!data) {
-			data = new resource_data_t{std::shared_ptr<requests_base_t>(), 0};
+			data = resource_data_t::create(resource);
 			//cout << "malloc data struct for res(" << get_id() << "), counter = " << data->counter << endl;
 			wl_resource_set_user_data(resource, data);
+			wl_resource_set_destructor(resource, c_destroy);
 		}
 		data->counter++;
 	}
 }
 
-resource_t::resource_t(const resource_t &p) : object_t(p) {
+resource_t::resource_t(const resource_t &p)
+	: object_t(p), resource(NULL), data(NULL), display(false), dontdestroy(false), interface(NULL) {
 	operator=(p);
 }
 
 resource_t &resource_t::operator=(const resource_t& p) {
+	if(&p == this)
+		return *this;
+	unref();
 	//object_t::operator=(object_t((wl_object *)p.resource));
 	//object_t::operator=((wl_object *)p.resource);
 	object_t::operator=(p);
@@ -177,9 +183,10 @@ resource_t &resource_t::operator=(const resource_t& p) {
 
 	if(!data) {
 		std::cerr << "Found resource_t without meta data." << std::endl;
-		data = new resource_data_t{std::shared_ptr<requests_base_t>(), 0};
+		data = resource_data_t::create(resource);
 		cout << "malloc data struct for res(" << get_id() << "), counter = " << data->counter << endl;
 		wl_resource_set_user_data(resource, data);
+		wl_resource_set_destructor(resource, c_destroy);
 	}
 	data->counter++;
 
@@ -203,19 +210,44 @@ resource_t &resource_t::operator=(resource_t &&p) {
 }
 
 resource_t::~resource_t() {
-	if(resource && !display) {
+	unref();
+}
+
+void resource_t::unref() {
+	if(resource && !display && data) {
 		data->counter--;
 		if(data->counter == 0) {
-			if(!dontdestroy) {
+			if(data->destroyed) {
+				resource_data_t::release(data);
+			} else if(!dontdestroy) {
 				//if(data->destroy_opcode >= 0) {
 				//	wl_resource_marshal(resource, data->destroy_opcode);
 				//}
 				cout << "destroy resource(" << get_id() << ")" << endl;
+				// c_destroy frees the data
 				wl_resource_destroy(resource);
 			}
-			delete data;
+			// with dontdestroy the data stays attached until c_destroy
 		}
 	}
+	resource = NULL;
+	data = NULL;
+}
+
+void resource_t::destroy() {
+	if(!resource || display || !data || data->destroyed)
+		return;
+	wl_resource_destroy(resource);
+}
+
+bool resource_t::is_destroyed() {
+	return data && data->destroyed;
+}
+
+void resource_t::add_destroy_listener(std::function<void()> listener) {
+	if(!data || data->destroyed)
+		throw std::invalid_argument("resource is destroyed");
+	data->destroy_listeners.push_back(listener);
 }
 
 uint32_t resource_t::get_id() {
@@ -229,13 +261,29 @@ client_t resource_t::get_client() {
 }
 
 uint32_t resource_t::get_version() {
-	return wl_resource_get_version(c_ptr());
+	if(display || !data)
+		return wl_resource_get_version(c_ptr());
+	if(!data->version)
+		data->version = wl_resource_get_version(c_ptr());
+	return data->version;
 }
 
 std::string resource_t::get_class() {
+	return get_class_name();
+}
+
+const char *resource_t::get_class_name() {
 	return wl_resource_get_class(c_ptr());
 }
 
+interface_id_t resource_t::get_class_id() {
+	if(!data)
+		return fnv1a(get_class_name());
+	if(!data->class_id)
+		data->class_id = fnv1a(get_class_name());
+	return data->class_id;
+}
+
 //void resource_t::set_queue(event_queue_t queue) {
 //	wl_resource_set_queue(c_ptr(), queue.c_ptr());
 //}
@@ -249,7 +297,7 @@ void resource_t::set_user_data(void *user_data) {
 }
 
 void *resource_t::get_user_data() {
-	if (data == NULL) {
+	if (data == NULL || data->destroyed) {
 		return NULL;
 	} else {
 		return data->user_data;
@@ -259,6 +307,8 @@ void *resource_t::get_user_data() {
 wl_resource *resource_t::c_ptr() {
 	if(!resource)
 		throw std::invalid_argument("resource is NULL");
+	if(data && data->destroyed)
+		throw std::invalid_argument("resource is destroyed");
 	return resource;
 }
 
@@ -276,24 +326,162 @@ void resource_t::post_error(uint32_t code, const char *msg, ...) {
 }
 
 resource_t::resource_data_t::resource_data_t()
-	: requests(NULL), user_data(NULL) {
+	: requests(NULL), thunks(NULL), class_id(0), version(0), user_data(NULL), destroyed(false), arena(NULL) {
 }
 
 resource_t::resource_data_t::resource_data_t(std::shared_ptr<requests_base_t> ev,
 		unsigned int cnt)
-	: requests(ev), counter(cnt), user_data(NULL) {
+	: requests(ev), thunks(NULL), counter(cnt), class_id(0), version(0), user_data(NULL), destroyed(false), arena(NULL) {
+}
+
+resource_t::resource_data_t *resource_t::resource_data_t::create(wl_resource *resource) {
+	detail::client_arena_t *arena = detail::client_arena_t::get(wl_resource_get_client(resource));
+	void *p = arena->allocate(sizeof(resource_data_t));
+	resource_data_t *data = new (p) resource_data_t(std::shared_ptr<requests_base_t>(), 0);
+	data->arena = arena;
+	return data;
+}
+
+void resource_t::resource_data_t::release(resource_data_t *data) {
+	detail::client_arena_t *arena = data->arena;
+	data->~resource_data_t();
+	arena->deallocate(data, sizeof(resource_data_t));
+}
+
+client_arena_t::client_arena_t()
+	: chunk_pos(NULL), chunk_end(NULL), refs(1) {
+	for(auto &list : free_lists)
+		list = NULL;
+	client_destroyed.listener.notify = c_client_destroyed;
+	client_destroyed.arena = this;
+}
+
+client_arena_t::~client_arena_t() {
+	for(char *chunk : chunks)
+		delete[] chunk;
+}
+
+client_arena_t *client_arena_t::get(wl_client *client) {
+	wl_listener *listener = wl_client_get_destroy_listener(client, c_client_destroyed);
+	if(listener)
+		return reinterpret_cast<listener_t*>(listener)->arena;
+
+	client_arena_t *arena = new client_arena_t;
+	wl_client_add_destroy_listener(client, &arena->client_destroyed.listener);
+	return arena;
+}
+
+void client_arena_t::c_client_destroyed(wl_listener *listener, void *data) {
+	client_arena_t *arena = reinterpret_cast<listener_t*>(listener)->arena;
+	wl_list_remove(&listener->link);
+	// resources still to be destroyed keep it alive
+	arena->unref();
+}
+
+void client_arena_t::unref() {
+	bool last;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		last = --refs == 0;
+	}
+	if(last)
+		delete this;
+}
+
+void *client_arena_t::allocate(size_t size) {
+	size_t cls = (size + granule - 1) / granule;
+	if(cls == 0 || cls > size_classes) {
+		void *p = ::operator new(size);
+		std::lock_guard<std::mutex> guard(lock);
+		refs++;
+		return p;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	free_block_t *block = free_lists[cls - 1];
+	if(block) {
+		free_lists[cls - 1] = block->next;
+	} else {
+		size_t bytes = cls * granule;
+		if(static_cast<size_t>(chunk_end - chunk_pos) < bytes) {
+			// the rest of the old chunk is left over, blocks are small
+			chunk_pos = new char[chunk_size];
+			chunk_end = chunk_pos + chunk_size;
+			chunks.push_back(chunk_pos);
+		}
+		block = reinterpret_cast<free_block_t*>(chunk_pos);
+		chunk_pos += bytes;
+	}
+	refs++;
+	return block;
+}
+
+void client_arena_t::deallocate(void *p, size_t size) {
+	size_t cls = (size + granule - 1) / granule;
+	if(cls == 0 || cls > size_classes) {
+		::operator delete(p);
+	} else {
+		free_block_t *block = static_cast<free_block_t*>(p);
+		std::lock_guard<std::mutex> guard(lock);
+		block->next = free_lists[cls - 1];
+		free_lists[cls - 1] = block;
+	}
+	unref();
 }
 
 
 void resource_t::set_requests(std::shared_ptr<requests_base_t> requests,
-		int(*dispatcher)(int, std::vector<any>, std::shared_ptr<resource_t::requests_base_t>)) {
-	if(!display && !data->requests) {
+		const request_thunk_t *thunks) {
+	if(!display && !data->destroyed && !data->requests) {
 		data->requests = requests;
-		// the dispatcher gets 'implemetation'
-		wl_resource_set_dispatcher(resource, c_dispatcher, reinterpret_cast<void *>(dispatcher), data, c_destroy);
+		data->thunks = thunks;
+		// the thunk table gets 'implementation'
+		wl_resource_set_dispatcher(resource, c_dispatcher, thunks, data, c_destroy);
 	}
 }
 
+const resource_t::request_thunk_t *resource_t::get_request_thunks() {
+	if(!display)
+		return data->thunks;
+	return NULL;
+}
+
+resource_t resource_t::arg_object(const wl_argument &arg) {
+	if(arg.o)
+		return resource_t(reinterpret_cast<wl_resource*>(arg.o));
+	return resource_t();
+}
+
+resource_t resource_t::arg_new_id(resource_t &res, const wl_message *message,
+		unsigned int index, const wl_argument &arg) {
+	// untyped new_ids (wl_registry.bind) carry no interface here,
+	// their handler has to create the resource itself
+	const interface_t *iface = message->types[index];
+	if(arg.n == 0 || !iface)
+		return resource_t();
+	wl_resource *resource = wl_resource_create(res.get_client().c_ptr(), iface, res.get_version(), arg.n);
+	if(!resource)
+		throw std::bad_alloc();
+	wl_resource_set_user_data(resource, NULL); // Wayland leaves the user data uninitialized
+	return resource_t(resource);
+}
+
+fixed_t resource_t::arg_fixed(const wl_argument &arg) {
+	fixed_t f;
+	f.set_data(arg.f);
+	return f;
+}
+
+std::string resource_t::arg_string(const wl_argument &arg) {
+	return arg.s ? std::string(arg.s) : std::string();
+}
+
+array_t resource_t::arg_array(const wl_argument &arg) {
+	if(arg.a)
+		return array_t(arg.a);
+	return array_t();
+}
+
 int resource_t::c_dispatcher(const void *implementation, void *target, uint32_t opcode, const wl_message *message, wl_argument *args) {
 	if(!implementation)
 		throw std::invalid_argument("resource dispatcher: implementation is NULL.");
@@ -304,86 +492,49 @@ int resource_t::c_dispatcher(const void *implementation, void *target, uint32_t
 	if(!args)
 		throw std::invalid_argument("resource dispatcher: args is NULL.");
 
-	std::string signature(message->signature);
-	std::vector<any> vargs;
 	resource_t res(reinterpret_cast<wl_resource*>(target), false);
 	client_t client = res.get_client();
-	unsigned int c = 0;
-	for(char ch : signature) {
-	//for (int i = 0; i < signature.size(); i++) {
-	//	auto ch = signature[i];
-		if(ch == '?' || isdigit(ch))
-			continue;
-
-		any a;
-		switch(ch) {
-			// int_32_t
-			case 'i':
-			case 'h':
-				a = args[c].i;
-				break;
-			// uint32_t
-			case 'u':
-				a = args[c].u;
-				break;
-			// fixed
-			case 'f':
-			{
-				fixed_t f;
-				f.set_data(args[c].f);
-				a = f;
-				break;
-			}
-			// string
-			case 's':
-				if(args[c].s)
-					a = std::string(args[c].s);
-				else
-					a = std::string("");
-				break;
-			// resource
-			case 'o':
-				if(args[c].o)
-					a = resource_t(reinterpret_cast<wl_resource*>(args[c].o));
-				else
-					a = resource_t();
-				break;
-			// new id
-			case 'n': {
-				//wl_resource *resource = reinterpret_cast<wl_resource*>(args[c].o);
-				int id = args[c].u;
-				if(id == 0) {
-					a = resource_t();
-					std::cerr << "New id is empty." << std::endl;
-					return 1;
-				}
-				//wl_resource *resource = wl_client_get_object(client.c_ptr(), id);
-				const interface_t *iface = message->types[c];
-				wl_resource *resource = wl_resource_create(client.c_ptr(), iface, res.get_version(), id);
-				wl_resource_set_user_data(resource, NULL); // Wayland leaves the user data uninitialized
-				a = resource_t(resource);
-				break;
-			}
-			// array
-			case 'a':
-				if(args[c].a)
-					a = array_t(args[c].a);
-				else
-					a = array_t();
-				break;
-			default:
-				a = 0;
-				break;
-		}
-		vargs.push_back(a);
-		c++;
+	const request_thunk_t *thunks = static_cast<const request_thunk_t*>(implementation);
+	// keeps the handlers alive even if one of them destroys the resource
+	std::shared_ptr<requests_base_t> requests = res.get_requests();
+
+	// Exceptions must not unwind through libwayland. A handler that
+	// throws is a compositor bug, but only the client gets to pay.
+	try {
+		return thunks[opcode](res, requests.get(), message, args);
+	} catch(std::bad_alloc &e) {
+		wl_client_post_no_memory(client.c_ptr());
+	} catch(std::exception &e) {
+		std::cerr << "Exception in handler of request " << message->name
+		          << ": " << e.what() << std::endl;
+		wl_resource *display = wl_client_get_object(client.c_ptr(), 1);
+		if(display)
+			wl_resource_post_error(display, static_cast<uint32_t>(display_error::invalid_method),
+			                       "%s: %s", message->name, e.what());
 	}
-	dispatcher_func dispatcher = reinterpret_cast<dispatcher_func>(const_cast<void*>(implementation));
-	//std::shared_ptr<requests_base_t> reqs = res.get_requests();
-	return dispatcher(opcode, vargs, res.get_requests());
+	return 0;
 }
 
 void resource_t::c_destroy(wl_resource *resource) {
+	resource_data_t *data = reinterpret_cast<resource_data_t*>(wl_resource_get_user_data(resource));
+	if(!data)
+		return;
+
+	// Copies made or dropped by the listeners must not bring the
+	// counter to zero while the listeners still run.
+	data->counter++;
+	data->destroyed = true;
+	std::list<std::function<void()>> listeners;
+	std::swap(listeners, data->destroy_listeners);
+	for(auto &listener : listeners)
+		listener();
+	listeners.clear();
+	data->user_data = NULL;
+	data->counter--;
+
+	wl_resource_set_user_data(resource, NULL);
+	if(data->counter == 0)
+		resource_data_t::release(data);
 }
 
 void resource_t::marshal_vector(int opcode, std::vector<argument_t> args) {
@@ -392,9 +543,10 @@ void resource_t::marshal_vector(int opcode, std::vector<argument_t> args) {
 		v.push_back(arg.argument);
 	}
 
-	//data->lock.lock();
+	if(!resource || (data && data->destroyed))
+		return;
+
 	wl_resource_post_event_array(resource, opcode, v.data());
-	//data->lock.unlock();
 	return;
 }
 
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * Copyright (c) 2016-2017, Yisu Peng
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <wayland-shm.hpp>
+#include <wayland-shm-convert.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHM_CONVERT_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+using namespace wayland;
+
+// All wl_shm formats are little endian, as is every host this runs on.
+static inline uint32_t load_u32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint8_t clamp_u8(int v) {
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// BT.601 limited range
+static inline void yuv_to_rgba(uint8_t *d, int y, int u, int v) {
+	int c = 298 * (y - 16) + 128;
+	int e = u - 128;
+	int f = v - 128;
+	d[0] = clamp_u8((c + 409 * f) >> 8);
+	d[1] = clamp_u8((c - 100 * e - 208 * f) >> 8);
+	d[2] = clamp_u8((c + 516 * e) >> 8);
+	d[3] = 0xff;
+}
+
+/*
+ * Plain C kernels
+ */
+
+static void argb8888_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 4;
+	for (int i = 0; i < w; i++, s += 4, d += 4) {
+		d[0] = s[2];
+		d[1] = s[1];
+		d[2] = s[0];
+		d[3] = s[3];
+	}
+}
+
+static void xrgb8888_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 4;
+	for (int i = 0; i < w; i++, s += 4, d += 4) {
+		d[0] = s[2];
+		d[1] = s[1];
+		d[2] = s[0];
+		d[3] = 0xff;
+	}
+}
+
+static void abgr8888_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	memcpy(d, s + x * 4, w * 4);
+}
+
+static void xbgr8888_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 4;
+	for (int i = 0; i < w; i++, s += 4, d += 4) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = 0xff;
+	}
+}
+
+static void rgba8888_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 4;
+	for (int i = 0; i < w; i++, s += 4, d += 4) {
+		d[0] = s[3];
+		d[1] = s[2];
+		d[2] = s[1];
+		d[3] = s[0];
+	}
+}
+
+static void rgb565_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 2;
+	for (int i = 0; i < w; i++, s += 2, d += 4) {
+		unsigned int v = s[0] | (s[1] << 8);
+		unsigned int r = v >> 11;
+		unsigned int g = (v >> 5) & 0x3f;
+		unsigned int b = v & 0x1f;
+		d[0] = (r << 3) | (r >> 2);
+		d[1] = (g << 2) | (g >> 4);
+		d[2] = (b << 3) | (b >> 2);
+		d[3] = 0xff;
+	}
+}
+
+static void xrgb2101010_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	s += x * 4;
+	for (int i = 0; i < w; i++, s += 4, d += 4) {
+		uint32_t v = load_u32(s);
+		d[0] = v >> 22;
+		d[1] = v >> 12;
+		d[2] = v >> 2;
+		d[3] = 0xff;
+	}
+}
+
+static void nv12_row_c(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	for (int i = x; i < x + w; i++, d += 4) {
+		const uint8_t *c = uv + (i & ~1);
+		yuv_to_rgba(d, s[i], c[0], c[1]);
+	}
+}
+
+static void yuyv_row_c(uint8_t *d, const uint8_t *s, const uint8_t *, int x, int w) {
+	for (int i = x; i < x + w; i++, d += 4) {
+		const uint8_t *p = s + (i & ~1) * 2;
+		yuv_to_rgba(d, p[(i & 1) * 2], p[1], p[3]);
+	}
+}
+
+#ifdef SHM_CONVERT_X86
+
+/*
+ * SSE2 kernels, 4 or 8 pixels per iteration with the C kernel for
+ * the remainder
+ */
+
+static void argb8888_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), b);
+		__m128i bl = _mm_slli_epi32(_mm_and_si128(v, b), 16);
+		v = _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(r, bl));
+		_mm_storeu_si128((__m128i *)d, v);
+	}
+	argb8888_row_c(d, s, uv, x + i, w - i);
+}
+
+static void xrgb8888_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i g = _mm_set1_epi32(0x0000ff00);
+	const __m128i a = _mm_set1_epi32(0xff000000);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), b);
+		__m128i bl = _mm_slli_epi32(_mm_and_si128(v, b), 16);
+		v = _mm_or_si128(_mm_or_si128(_mm_and_si128(v, g), a), _mm_or_si128(r, bl));
+		_mm_storeu_si128((__m128i *)d, v);
+	}
+	xrgb8888_row_c(d, s, uv, x + i, w - i);
+}
+
+static void xbgr8888_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i a = _mm_set1_epi32(0xff000000);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(v, a));
+	}
+	xbgr8888_row_c(d, s, uv, x + i, w - i);
+}
+
+static void rgba8888_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		// swap bytes in each 16 bit half, then swap the halves
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128((__m128i *)d, v);
+	}
+	rgba8888_row_c(d, s, uv, x + i, w - i);
+}
+
+// store 8 pixels given as 16 bit channels
+static inline void store_rgba_8px(uint8_t *d, __m128i r, __m128i g, __m128i b) {
+	const __m128i a = _mm_set1_epi16(0xff);
+	__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+	__m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+	_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+static void rgb565_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i m5 = _mm_set1_epi16(0x1f);
+	const __m128i m6 = _mm_set1_epi16(0x3f);
+	const uint8_t *p = s + x * 2;
+	int i = 0;
+	for (; i + 8 <= w; i += 8, p += 16, d += 32) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i r = _mm_srli_epi16(v, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), m6);
+		__m128i b = _mm_and_si128(v, m5);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+		store_rgba_8px(d, r, g, b);
+	}
+	rgb565_row_c(d, s, uv, x + i, w - i);
+}
+
+static void xrgb2101010_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i m = _mm_set1_epi32(0xff);
+	const __m128i a = _mm_set1_epi32(0xff000000);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i r = _mm_and_si128(_mm_srli_epi32(v, 22), m);
+		__m128i g = _mm_and_si128(_mm_srli_epi32(v, 12), m);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(v, 2), m);
+		v = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+				_mm_or_si128(_mm_slli_epi32(b, 16), a));
+		_mm_storeu_si128((__m128i *)d, v);
+	}
+	xrgb2101010_row_c(d, s, uv, x + i, w - i);
+}
+
+// BT.601 limited range for 8 pixels given as 16 bit y, u and v,
+// using madd to get 32 bit intermediates
+static inline void yuv_to_rgba_8px_sse2(uint8_t *d, __m128i y, __m128i u, __m128i v) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i c_y = _mm_set_epi16(128, 298, 128, 298, 128, 298, 128, 298);
+	const __m128i c_r = _mm_set_epi16(0, 409, 0, 409, 0, 409, 0, 409);
+	const __m128i c_g = _mm_set_epi16(-208, -100, -208, -100, -208, -100, -208, -100);
+	const __m128i c_b = _mm_set_epi16(0, 516, 0, 516, 0, 516, 0, 516);
+
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i e = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	__m128i f = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+	__m128i out[3];
+	for (int half = 0; half < 2; half++) {
+		__m128i cc, ef, e0, f0;
+		if (half == 0) {
+			cc = _mm_unpacklo_epi16(c, one);
+			ef = _mm_unpacklo_epi16(e, f);
+			e0 = _mm_unpacklo_epi16(e, zero);
+			f0 = _mm_unpacklo_epi16(f, zero);
+		} else {
+			cc = _mm_unpackhi_epi16(c, one);
+			ef = _mm_unpackhi_epi16(e, f);
+			e0 = _mm_unpackhi_epi16(e, zero);
+			f0 = _mm_unpackhi_epi16(f, zero);
+		}
+		__m128i t = _mm_madd_epi16(cc, c_y);
+		__m128i r = _mm_srai_epi32(_mm_add_epi32(t, _mm_madd_epi16(f0, c_r)), 8);
+		__m128i g = _mm_srai_epi32(_mm_add_epi32(t, _mm_madd_epi16(ef, c_g)), 8);
+		__m128i b = _mm_srai_epi32(_mm_add_epi32(t, _mm_madd_epi16(e0, c_b)), 8);
+		if (half == 0) {
+			out[0] = r;
+			out[1] = g;
+			out[2] = b;
+		} else {
+			// saturate to 0..255, keeping 16 bit lanes
+			out[0] = _mm_packs_epi32(out[0], r);
+			out[1] = _mm_packs_epi32(out[1], g);
+			out[2] = _mm_packs_epi32(out[2], b);
+		}
+	}
+	__m128i r = _mm_unpacklo_epi8(_mm_packus_epi16(out[0], zero), zero);
+	__m128i g = _mm_unpacklo_epi8(_mm_packus_epi16(out[1], zero), zero);
+	__m128i b = _mm_unpacklo_epi8(_mm_packus_epi16(out[2], zero), zero);
+	store_rgba_8px(d, r, g, b);
+}
+
+static void nv12_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	// chroma is shared by pixel pairs, start on an even column
+	if ((x & 1) && w > 0) {
+		nv12_row_c(d, s, uv, x, 1);
+		i = 1;
+		d += 4;
+	}
+	for (; i + 8 <= w; i += 8, d += 32) {
+		__m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(s + x + i)), zero);
+		// 4 u/v pairs, duplicated for both pixels of a pair
+		__m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(uv + x + i)), zero);
+		// c holds u0 v0 u1 v1 ..., spread each pair over two pixels
+		__m128i u = _mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0));
+		u = _mm_shufflehi_epi16(u, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128i v = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 1, 1));
+		yuv_to_rgba_8px_sse2(d, y, u, v);
+	}
+	nv12_row_c(d, s, uv, x + i, w - i);
+}
+
+static void yuyv_row_sse2(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i lo = _mm_set1_epi16(0xff);
+	int i = 0;
+	if ((x & 1) && w > 0) {
+		yuyv_row_c(d, s, uv, x, 1);
+		i = 1;
+		d += 4;
+	}
+	for (; i + 8 <= w; i += 8, d += 32) {
+		// y0 u0 y1 v0 y2 u1 y3 v1 ...
+		__m128i p = _mm_loadu_si128((const __m128i *)(s + (x + i) * 2));
+		__m128i y = _mm_and_si128(p, lo);
+		__m128i c = _mm_srli_epi16(p, 8);
+		__m128i u = _mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0));
+		u = _mm_shufflehi_epi16(u, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128i v = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 1, 1));
+		yuv_to_rgba_8px_sse2(d, y, u, v);
+	}
+	yuyv_row_c(d, s, uv, x + i, w - i);
+}
+
+/*
+ * SSSE3 kernels, a single byte shuffle per 4 pixels
+ */
+
+__attribute__((target("ssse3")))
+static void argb8888_row_ssse3(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+			10, 9, 8, 11, 14, 13, 12, 15);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(v, shuf));
+	}
+	argb8888_row_c(d, s, uv, x + i, w - i);
+}
+
+__attribute__((target("ssse3")))
+static void xrgb8888_row_ssse3(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+			10, 9, 8, 11, 14, 13, 12, 15);
+	const __m128i a = _mm_set1_epi32(0xff000000);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(_mm_shuffle_epi8(v, shuf), a));
+	}
+	xrgb8888_row_c(d, s, uv, x + i, w - i);
+}
+
+__attribute__((target("ssse3")))
+static void rgba8888_row_ssse3(uint8_t *d, const uint8_t *s, const uint8_t *uv, int x, int w) {
+	const __m128i shuf = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+			11, 10, 9, 8, 15, 14, 13, 12);
+	const uint8_t *p = s + x * 4;
+	int i = 0;
+	for (; i + 4 <= w; i += 4, p += 16, d += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(v, shuf));
+	}
+	rgba8888_row_c(d, s, uv, x + i, w - i);
+}
+
+#endif
+
+/*
+ * Dispatch table
+ */
+
+struct format_kernels_t {
+	shm_format format;
+	shm_converter_t::row_func_t c;
+	shm_converter_t::row_func_t sse2;
+	shm_converter_t::row_func_t ssse3;
+};
+
+#ifdef SHM_CONVERT_X86
+#define KERNELS(fmt, sse2, ssse3) \
+	{ shm_format::fmt, fmt##_row_c, sse2, ssse3 }
+#else
+#define KERNELS(fmt, sse2, ssse3) \
+	{ shm_format::fmt, fmt##_row_c, NULL, NULL }
+#endif
+
+static const format_kernels_t format_kernels[] = {
+	KERNELS(argb8888, argb8888_row_sse2, argb8888_row_ssse3),
+	KERNELS(xrgb8888, xrgb8888_row_sse2, xrgb8888_row_ssse3),
+	KERNELS(abgr8888, NULL, NULL),
+	KERNELS(xbgr8888, xbgr8888_row_sse2, NULL),
+	KERNELS(rgba8888, rgba8888_row_sse2, rgba8888_row_ssse3),
+	KERNELS(rgb565, rgb565_row_sse2, NULL),
+	KERNELS(xrgb2101010, xrgb2101010_row_sse2, NULL),
+	KERNELS(nv12, nv12_row_sse2, NULL),
+	KERNELS(yuyv, yuyv_row_sse2, NULL),
+};
+
+#undef KERNELS
+
+static const format_kernels_t *find_kernels(shm_format format) {
+	for (auto &k : format_kernels) {
+		if (k.format == format) {
+			return &k;
+		}
+	}
+	return NULL;
+}
+
+bool shm_converter_t::is_supported(shm_format format) {
+	return find_kernels(format) != NULL;
+}
+
+std::vector<shm_format> shm_converter_t::get_formats() {
+	std::vector<shm_format> formats;
+	for (auto &k : format_kernels) {
+		formats.push_back(k.format);
+	}
+	return formats;
+}
+
+shm_converter_t::shm_converter_t(shm_format fmt)
+	: format(fmt) {
+	const format_kernels_t *k = find_kernels(format);
+	if (!k) {
+		throw std::invalid_argument("unsupported shm format");
+	}
+
+	row_func = k->c;
+	implementation = "c";
+#ifdef SHM_CONVERT_X86
+	__builtin_cpu_init();
+	if (k->ssse3 && __builtin_cpu_supports("ssse3")) {
+		row_func = k->ssse3;
+		implementation = "ssse3";
+	} else if (k->sse2 && __builtin_cpu_supports("sse2")) {
+		row_func = k->sse2;
+		implementation = "sse2";
+	}
+#endif
+}
+
+shm_converter_t::shm_converter_t(shm_format fmt, const std::string &impl)
+	: format(fmt) {
+	const format_kernels_t *k = find_kernels(format);
+	if (!k) {
+		throw std::invalid_argument("unsupported shm format");
+	}
+
+	row_func = NULL;
+	if (impl == "c") {
+		row_func = k->c;
+		implementation = "c";
+	}
+#ifdef SHM_CONVERT_X86
+	__builtin_cpu_init();
+	if (impl == "ssse3" && k->ssse3 && __builtin_cpu_supports("ssse3")) {
+		row_func = k->ssse3;
+		implementation = "ssse3";
+	} else if (impl == "sse2" && k->sse2 && __builtin_cpu_supports("sse2")) {
+		row_func = k->sse2;
+		implementation = "sse2";
+	}
+#endif
+	if (!row_func) {
+		throw std::invalid_argument("shm format kernel not available: " + impl);
+	}
+}
+
+shm_format shm_converter_t::get_format() {
+	return format;
+}
+
+bool shm_converter_t::is_passthrough() {
+	return format == shm_format::abgr8888;
+}
+
+const char *shm_converter_t::get_implementation() {
+	return implementation;
+}
+
+void shm_converter_t::convert(uint8_t *dst, int dst_stride,
+		const uint8_t *src, int src_stride,
+		int32_t width, int32_t height, shm_rect_t rect) {
+	// clip, moving dst along with the top left corner
+	int32_t x0 = std::max(rect.x, 0);
+	int32_t y0 = std::max(rect.y, 0);
+	int32_t x1 = std::min(rect.x + rect.width, width);
+	int32_t y1 = std::min(rect.y + rect.height, height);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+	dst += (y0 - rect.y) * dst_stride + (x0 - rect.x) * 4;
+
+	const uint8_t *uv_plane = NULL;
+	if (format == shm_format::nv12) {
+		uv_plane = src + src_stride * height;
+	}
+
+	for (int32_t y = y0; y < y1; y++, dst += dst_stride) {
+		const uint8_t *row = src + y * src_stride;
+		const uint8_t *uv = uv_plane ? uv_plane + (y / 2) * src_stride : NULL;
+		row_func(dst, row, uv, x0, x1 - x0);
+	}
+}
+
+void shm_converter_t::convert(shm_buffer_t &buffer, uint8_t *dst, int dst_stride,
+		shm_rect_t rect) {
+	shm_buffer_access_t access(&buffer);
+	convert(dst, dst_stride, static_cast<const uint8_t *>(buffer.get_data()),
+			buffer.get_stride(), buffer.get_width(), buffer.get_height(), rect);
+}
@@ -25,17 +25,89 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 #include <wayland-shm.hpp>
+#include <wayland-shm-convert.hpp>
 
 #include <wayland-server-protocol.hpp>
 
 using namespace wayland;
 using namespace wayland::detail;
 
+// Pool being accessed by this thread. A client may truncate the file
+// backing its pool, turning reads from the mapping into SIGBUS. The
+// handler replaces the mapping of the active pool with zero pages and
+// remembers to kill the client once the access ends.
+struct sigbus_data_t {
+	shm_pool_t *pool;
+	int access_count;
+	bool fallback_mapping_used;
+};
+
+static thread_local sigbus_data_t sigbus_data = { NULL, 0, false };
+static struct sigaction old_sigbus_action;
+static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+
+static void reraise_sigbus() {
+	// If SIGBUS is raised for some other reason than accessing
+	// the pool then we'll uninstall the signal handler so we can
+	// reraise it. This would presumably kill the process.
+	sigaction(SIGBUS, &old_sigbus_action, NULL);
+	raise(SIGBUS);
+}
+
+void shm_pool_t::sigbus_handler(int signum, siginfo_t *info, void *context) {
+	shm_pool_t *pool = sigbus_data.pool;
+	if (!pool ||
+			(char *)info->si_addr < pool->data ||
+			(char *)info->si_addr >= pool->data + pool->size) {
+		reraise_sigbus();
+		return;
+	}
+
+	sigbus_data.fallback_mapping_used = true;
+
+	// This should replace the previous mapping
+	if (mmap(pool->data, pool->size,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS,
+				0, 0) == MAP_FAILED) {
+		reraise_sigbus();
+		return;
+	}
+}
+
+void shm_pool_t::init_sigbus_handler() {
+	struct sigaction new_action;
+	memset(&new_action, 0, sizeof new_action);
+	new_action.sa_sigaction = shm_pool_t::sigbus_handler;
+	sigemptyset(&new_action.sa_mask);
+	new_action.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+	sigaction(SIGBUS, &new_action, &old_sigbus_action);
+}
+
+// Rows of stride bytes a buffer of format occupies
+static int64_t buffer_rows(shm_format format, int32_t height) {
+	switch (format) {
+	case shm_format::nv12:
+	case shm_format::nv21:
+		// half height chroma plane after the luma plane
+		return static_cast<int64_t>(height) + (height + 1) / 2;
+	default:
+		return height;
+	}
+}
+
 shm_buffer_t::shm_buffer_t(shm_pool_t &pl,
 			int off, int w, int h, int s, shm_format fmt)
 	: pool(&pl)
@@ -51,6 +123,11 @@ shm_buffer_t::shm_buffer_t(shm_pool_t &pl,
 	format = fmt;
 	stride = s;
 	offset = off;
+	pool->internal_refcount++;
+}
+
+shm_buffer_t::~shm_buffer_t() {
+	pool->unref(false);
 }
 
 shm_buffer_t *shm_buffer_t::from_resource(buffer_resource_t res) {
@@ -66,6 +143,12 @@ void shm_buffer_t::bind(buffer_resource_t res) {
 	//res_list.push_back(res);
 	resource = res;
 	res.set_user_data(this);
+	res.on_destroy() = [this] () {
+		resource.destroy();
+	};
+	res.add_destroy_listener([this] () {
+		delete this;
+	});
 }
 
 void *shm_buffer_t::get_data() {
@@ -97,6 +180,54 @@ int shm_buffer_t::get_height() {
 	//return wl_shm_buffer_get_height(buffer);
 }
 
+shm_pool_t *shm_buffer_t::ref_pool() {
+	pool->external_refcount++;
+	return pool;
+}
+
+void shm_buffer_t::begin_access() {
+	ref_pool();
+
+	pthread_once(&sigbus_once, shm_pool_t::init_sigbus_handler);
+
+	if (sigbus_data.access_count == 0) {
+		sigbus_data.pool = pool;
+		sigbus_data.fallback_mapping_used = false;
+	} else if (sigbus_data.pool != pool) {
+		// only one pool is protected per thread at a time
+		cerr << "Nested access to buffers of different shm pools." << endl;
+	}
+	sigbus_data.access_count++;
+}
+
+void shm_buffer_t::end_access() {
+	if (sigbus_data.access_count > 0 && sigbus_data.pool == pool) {
+		sigbus_data.access_count--;
+		if (sigbus_data.access_count == 0) {
+			if (sigbus_data.fallback_mapping_used && !resource.is_destroyed()) {
+				resource.post_error(static_cast<uint32_t>(shm_error::invalid_fd),
+						"error accessing SHM buffer");
+				sigbus_data.fallback_mapping_used = false;
+			}
+			sigbus_data.pool = NULL;
+		}
+	}
+	pool->unref(true);
+}
+
+shm_buffer_access_t::shm_buffer_access_t(shm_buffer_t *buf)
+	: buffer(buf) {
+	if (buffer) {
+		buffer->begin_access();
+	}
+}
+
+shm_buffer_access_t::~shm_buffer_access_t() {
+	if (buffer) {
+		buffer->end_access();
+	}
+}
+
 void shm_buffer_t::swap_BR_channels() {
 	uint8_t *sp = (uint8_t *)get_data();
 	unsigned char (*p)[4];
@@ -112,7 +243,8 @@ void shm_buffer_t::release() {
 	resource.send_release();
 }
 
-shm_pool_t::shm_pool_t(int32_t size, int fd) {
+shm_pool_t::shm_pool_t(int32_t size, int fd, std::vector<shm_format> fmts)
+	: formats(fmts) {
 	internal_refcount = 1;
 	external_refcount = 0;
 	this->size = size;
@@ -120,6 +252,35 @@ shm_pool_t::shm_pool_t(int32_t size, int fd) {
 	data = (char *)mmap(NULL, size,
 			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	close(fd);
+	if (data == MAP_FAILED) {
+		throw std::runtime_error(std::string("failed mmap fd: ") + strerror(errno));
+	}
+}
+
+shm_pool_t::~shm_pool_t() {
+	munmap(data, size);
+}
+
+void shm_pool_t::unref(bool external) {
+	if (external) {
+		external_refcount--;
+		assert(external_refcount >= 0);
+		if (external_refcount == 0) {
+			finish_resize();
+		}
+	} else {
+		internal_refcount--;
+		assert(internal_refcount >= 0);
+	}
+
+	if (internal_refcount + external_refcount > 0) {
+		return;
+	}
+	delete this;
+}
+
+void shm_pool_t::unref() {
+	unref(true);
 }
 
 void shm_pool_t::bind(shm_pool_resource_t res) {
@@ -128,18 +289,31 @@ void shm_pool_t::bind(shm_pool_resource_t res) {
 			int32_t width, int32_t height,
 			int32_t stride, shm_format format) {
 
-		if (offset < 0 || width <= 0 || height <= 0 || stride < width || 
-				INT32_MAX / stride <= height ||
-				offset > size - stride * height) {
-			throw std::runtime_error("invalid buffer parameters!");
+		if (std::find(formats.begin(), formats.end(), format) == formats.end()) {
+			resource.post_error(static_cast<uint32_t>(shm_error::invalid_format),
+					"invalid format 0x%x", static_cast<uint32_t>(format));
+			return;
+		}
+
+		// 64 bit arithmetic, none of this can overflow
+		int64_t min_stride = static_cast<int64_t>(width) * detail::shm_format_bpp(static_cast<uint32_t>(format));
+		int64_t end = static_cast<int64_t>(offset)
+			+ static_cast<int64_t>(stride) * buffer_rows(format, height);
+		if (offset < 0 || width <= 0 || height <= 0 ||
+				stride < min_stride || end > size) {
+			resource.post_error(static_cast<uint32_t>(shm_error::invalid_stride),
+					"invalid width, height or stride (%dx%d, %d)",
+					width, height, stride);
+			return;
 		}
-		internal_refcount++;
 		auto buf = new shm_buffer_t(*this, offset,
 				width, height, stride, format);
 		buf->bind(buf_res);
 	};
 	res.on_resize() = [&] (int32_t sz) {
 		if (sz < size) {
+			resource.post_error(static_cast<uint32_t>(shm_error::invalid_fd),
+					"shrinking pool invalid");
 			return;
 		}
 		new_size = sz;
@@ -152,6 +326,13 @@ void shm_pool_t::bind(shm_pool_resource_t res) {
 			finish_resize();
 		}
 	};
+	res.on_destroy() = [this] () {
+		resource.destroy();
+	};
+	// the resource holds the initial internal reference
+	res.add_destroy_listener([this] () {
+		unref(false);
+	});
 }
 
 void shm_pool_t::finish_resize() {
@@ -159,6 +340,11 @@ void shm_pool_t::finish_resize() {
 		return;
 	}
 	void *p = mremap(data, size, new_size, MREMAP_MAYMOVE);
+	if (p == MAP_FAILED) {
+		cerr << "failed to resize shm pool" << endl;
+		new_size = size;
+		return;
+	}
 	data = (char *)p;
 	size = new_size;
 }
@@ -174,26 +360,45 @@ void *shm_pool_t::get_data() {
 
 shm_t::shm_t(display_server_t disp)
 	: display(disp),
-	global_t(disp, shm_interface, 1, this, NULL)
+	global_t(disp, shm_interface, 1, this, NULL),
+	formats(shm_converter_t::get_formats())
 {
 }
 
+void shm_t::add_format(shm_format format) {
+	if (std::find(formats.begin(), formats.end(), format) == formats.end()) {
+		formats.push_back(format);
+	}
+}
+
 void shm_t::bind(resource_t res, void *data) {
 	shm_resource_t r(res);
-	res_list.push_back(r);
+	auto it = res_list.insert(res_list.end(), r);
+	r.add_destroy_listener([this, it] () {
+		res_list.erase(it);
+	});
 
-	r.send_format(shm_format::argb8888);
-	r.send_format(shm_format::rgba8888);
+	for (auto format : formats) {
+		r.send_format(format);
+	}
 
-	r.on_create_pool() = [&] (shm_pool_resource_t res,
+	r.on_create_pool() = [this, it] (shm_pool_resource_t res,
 			int fd, int32_t size) {
 		if (size <= 0) {
-			cerr << "invalid size(" << size << ")" << endl;
+			it->post_error(static_cast<uint32_t>(shm_error::invalid_stride),
+					"invalid size (%d)", size);
+			close(fd);
+			return;
+		}
+
+		shm_pool_t *pool;
+		try {
+			pool = new shm_pool_t(size, fd, formats);
+		} catch (std::runtime_error &e) {
+			it->post_error(static_cast<uint32_t>(shm_error::invalid_fd),
+					"%s", e.what());
+			return;
 		}
-		auto pool = new shm_pool_t(size, fd);
-		
 		pool->bind(res);
 	};
 }
-
-
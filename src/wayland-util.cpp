@@ -85,11 +85,16 @@ argument_t::argument_t(fixed_t f) {
 	is_array = false;
 }
 
-argument_t::argument_t(std::string s) {
+argument_t::argument_t(const std::string &s) {
 	argument.s = s.c_str();
 	is_array = false;
 }
 
+argument_t::argument_t(const char *s) {
+	argument.s = s;
+	is_array = false;
+}
+
 argument_t::argument_t(object_t *p) {
 	//argument.o = reinterpret_cast<wl_object*>(p->proxy);
 	argument.o = p->object;
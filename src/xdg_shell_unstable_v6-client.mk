@@ -2,14 +2,13 @@
 include ../defs.mk
 include ../functions.mk
 include ../rules.mk
+include xdg_shell_unstable_v6-protocol.mk
 
 TARGET = libxdg_shell_unstable_v6-client++.so
 
 LIBS = wayland-client++
 
-SRCS = \
-	xdg_shell_unstable_v6-client-protocol.cpp \
-	xdg_shell_unstable_v6-protocol.cpp
+SRCS = $(XDG_SHELL_UNSTABLE_V6_CLIENT_SRCS)
 
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
@@ -2,14 +2,13 @@
 include ../defs.mk
 include ../functions.mk
 include ../rules.mk
+include xdg_shell_unstable_v6-protocol.mk
 
 TARGET = libxdg_shell_unstable_v6-server++.so
 
 LIBS = wayland-server++
 
-SRCS = \
-	xdg_shell_unstable_v6-server-protocol.cpp \
-	xdg_shell_unstable_v6-protocol.cpp
+SRCS = $(XDG_SHELL_UNSTABLE_V6_SERVER_SRCS)
 
 
 $(eval $(call make_sharedlib,$(TARGET),$(SRCS),$(LIBS)))
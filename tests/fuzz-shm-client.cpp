@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <wayland-client.hpp>
+#include <wayland-client-shm.hpp>
+
+#include "fuzz-shm.hpp"
+
+using namespace wayland;
+
+namespace {
+// every pool is backed by a file of this size, the requested pool
+// sizes are whatever the input says
+const int32_t file_size = 64 * 1024;
+
+// formats handed out by index, so the valid paths are reached too
+const shm_format known_formats[] = {
+	shm_format::argb8888, shm_format::xrgb8888, shm_format::abgr8888,
+	shm_format::rgb565, shm_format::xrgb2101010, shm_format::nv12,
+	shm_format::yuyv
+};
+
+class input_t {
+	const uint8_t *data;
+	size_t size;
+
+public:
+	input_t(const uint8_t *d, size_t s)
+		: data(d), size(s) {
+	}
+
+	bool empty() {
+		return size == 0;
+	}
+
+	template <typename T>
+	T take() {
+		T value = 0;
+		size_t n = std::min(sizeof(T), size);
+		memcpy(&value, data, n);
+		data += n;
+		size -= n;
+		return value;
+	}
+
+	shm_format take_format() {
+		uint8_t index = take<uint8_t>();
+		if (index < sizeof(known_formats) / sizeof(known_formats[0]))
+			return known_formats[index];
+		return static_cast<shm_format>(take<uint32_t>());
+	}
+};
+}
+
+void run_fuzz_client(int fd, const uint8_t *data, size_t size,
+		std::function<void()> dispatch) {
+	// the proxies have to go before the connection
+	display_client_t display(fd);
+	registry_proxy_t registry;
+	shm_proxy_t shm;
+	std::vector<shm_pool_proxy_t> pools;
+	std::vector<buffer_proxy_t> buffers;
+
+	registry = display.get_registry();
+	registry.on_global() = [&] (uint32_t name, std::string interface, uint32_t version) {
+		if (interface == shm_proxy_t::interface_name)
+			registry.bind(name, shm, 1);
+	};
+	display.flush();
+	dispatch();
+	display.dispatch();
+	if (!shm)
+		return;
+
+	input_t in(data, size);
+	while (!in.empty()) {
+		switch (in.take<uint8_t>() % 4) {
+		case 0: {
+			int32_t pool_size = in.take<int32_t>();
+			int pool_fd = detail::create_anonymous_file(file_size);
+			pools.push_back(shm.create_pool(pool_fd, pool_size));
+			close(pool_fd);
+			break;
+		}
+		case 1: {
+			if (pools.empty())
+				break;
+			shm_pool_proxy_t &pool = pools[in.take<uint8_t>() % pools.size()];
+			int32_t offset = in.take<int32_t>();
+			int32_t width = in.take<int32_t>();
+			int32_t height = in.take<int32_t>();
+			int32_t stride = in.take<int32_t>();
+			shm_format format = in.take_format();
+			buffers.push_back(pool.create_buffer(offset, width, height, stride, format));
+			break;
+		}
+		case 2:
+			if (pools.empty())
+				break;
+			pools[in.take<uint8_t>() % pools.size()].resize(in.take<int32_t>());
+			break;
+		case 3: {
+			// destroy a pool or a buffer, in any order
+			uint8_t index = in.take<uint8_t>();
+			if (index & 1 && !pools.empty())
+				pools.erase(pools.begin() + (index >> 1) % pools.size());
+			else if (!buffers.empty())
+				buffers.erase(buffers.begin() + (index >> 1) % buffers.size());
+			break;
+		}
+		}
+
+		// a protocol error closes the connection, nothing left to fuzz
+		if (display.flush() < 0)
+			break;
+		dispatch();
+	}
+}
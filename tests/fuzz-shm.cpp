@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* libFuzzer driver for the wl_shm request handlers.
+ *
+ * Each input is a sequence of create_pool, create_buffer, resize and
+ * destroy requests with arbitrary arguments, sent by a fresh client
+ * over a socketpair. The compositor has to turn bad arguments into
+ * protocol errors and free everything when the client goes away.
+ * Build the tree with clang and SANITIZE=address,fuzzer-no-link,
+ * see tests/Makefile.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <wayland-server.hpp>
+#include <wayland-shm.hpp>
+
+#include "fuzz-shm.hpp"
+
+using namespace wayland;
+
+namespace {
+// one compositor for the whole fuzzing run, a client per input
+display_server_t *server;
+shm_t *shm;
+
+// handle what the client sent and send the replies right away,
+// the client may block reading them
+void dispatch() {
+	wl_display_flush_clients(server->c_ptr());
+	wl_event_loop_dispatch(wl_display_get_event_loop(server->c_ptr()), 0);
+	wl_display_flush_clients(server->c_ptr());
+}
+
+struct client_destroy_t {
+	wl_listener listener; // first member, see notify()
+	bool destroyed;
+
+	static void notify(wl_listener *listener, void *data) {
+		reinterpret_cast<client_destroy_t *>(listener)->destroyed = true;
+	}
+};
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (!server) {
+		server = new display_server_t("waylandpp-fuzz-shm-" + std::to_string(getpid()));
+		shm = new shm_t(*server);
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+		return 0;
+	wl_client *client = wl_client_create(server->c_ptr(), fds[0]);
+	if (!client) {
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+	client_destroy_t destroy;
+	destroy.destroyed = false;
+	destroy.listener.notify = client_destroy_t::notify;
+	wl_client_add_destroy_listener(client, &destroy.listener);
+
+	run_fuzz_client(fds[1], data, size, dispatch);
+
+	// the hangup frees whatever the client left behind
+	dispatch();
+	if (!destroy.destroyed)
+		wl_client_destroy(client);
+	return 0;
+}
@@ -0,0 +1,21 @@
+PROJDIR = ../
+
+include $(PROJDIR)defs.mk
+include $(PROJDIR)functions.mk
+include $(PROJDIR)rules.mk
+
+LIBS = wayland-server++ wayland-shm++ wayland-client++ wayland-server wayland-client
+
+# libFuzzer provides main()
+LDFLAGS += -fsanitize=fuzzer
+
+SRCS = \
+	   fuzz-shm.cpp \
+	   fuzz-shm-client.cpp
+
+
+$(eval $(call make_executable,fuzz-shm,$(SRCS),$(LIBS)))
+
+$(eval $(call print_vars,ALL_TARGETS))
+
+all: $(ALL_TARGETS)
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Throughput of the SHM format converters.
+ *
+ * Converts a 1920x1080 buffer of every supported format with every
+ * kernel set the CPU offers, once as a whole and once in 64x64 tiles,
+ * the way damage usually arrives. Prints megapixels per second.
+ *
+ * Before timing, every kernel set is checked against the C kernels on
+ * the whole frame, on the tiles and on a rectangle with odd offset and
+ * width, which exercises the scalar tails of the SIMD loops. Exits with
+ * a failure if any output differs.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <wayland-server.hpp>
+#include <wayland-shm-convert.hpp>
+
+using namespace wayland;
+
+static const int32_t width = 1920;
+static const int32_t height = 1080;
+static const int32_t tile = 64;
+static const double min_seconds = 0.25;
+
+static const char *format_name(shm_format format) {
+	switch (format) {
+	case shm_format::argb8888: return "argb8888";
+	case shm_format::xrgb8888: return "xrgb8888";
+	case shm_format::abgr8888: return "abgr8888";
+	case shm_format::xbgr8888: return "xbgr8888";
+	case shm_format::rgba8888: return "rgba8888";
+	case shm_format::rgb565: return "rgb565";
+	case shm_format::xrgb2101010: return "xrgb2101010";
+	case shm_format::nv12: return "nv12";
+	case shm_format::yuyv: return "yuyv";
+	default: return "?";
+	}
+}
+
+// converts rect into the same place of a width x height destination
+static void convert_rect(shm_converter_t &conv, std::vector<uint8_t> &dst,
+		const std::vector<uint8_t> &src, int src_stride, shm_rect_t rect) {
+	conv.convert(dst.data() + (rect.y * width + rect.x) * 4, width * 4,
+			src.data(), src_stride, width, height, rect);
+}
+
+// converts the whole buffer, rect by rect, and returns the seconds taken
+static double convert_frame(shm_converter_t &conv, std::vector<uint8_t> &dst,
+		const std::vector<uint8_t> &src, int src_stride, int32_t rect_size) {
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t y = 0; y < height; y += rect_size) {
+		for (int32_t x = 0; x < width; x += rect_size) {
+			convert_rect(conv, dst, src, src_stride,
+					{ x, y, rect_size, rect_size });
+		}
+	}
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+static double measure(shm_converter_t &conv, std::vector<uint8_t> &dst,
+		const std::vector<uint8_t> &src, int src_stride, int32_t rect_size) {
+	// warm up caches and the branch predictor
+	convert_frame(conv, dst, src, src_stride, rect_size);
+
+	double seconds = 0;
+	int frames = 0;
+	while (seconds < min_seconds) {
+		seconds += convert_frame(conv, dst, src, src_stride, rect_size);
+		frames++;
+	}
+	return static_cast<double>(width) * height * frames / seconds / 1e6;
+}
+
+// compares the output of conv with the C kernels, returns false on mismatch
+static bool check(shm_converter_t &conv, const char *impl,
+		shm_converter_t &ref, const std::vector<uint8_t> &src, int src_stride) {
+	const shm_rect_t odd_rect = { 3, 1, 1013, 333 };
+	std::vector<uint8_t> expected(width * height * 4);
+	std::vector<uint8_t> actual(width * height * 4);
+
+	for (int pass = 0; pass < 3; pass++) {
+		// pixels outside the rect have to stay untouched as well
+		memset(expected.data(), 0x5a, expected.size());
+		memset(actual.data(), 0x5a, actual.size());
+		const char *what;
+		switch (pass) {
+		case 0:
+			what = "frame";
+			convert_frame(ref, expected, src, src_stride, width);
+			convert_frame(conv, actual, src, src_stride, width);
+			break;
+		case 1:
+			what = "tiles";
+			convert_frame(ref, expected, src, src_stride, tile);
+			convert_frame(conv, actual, src, src_stride, tile);
+			break;
+		default:
+			what = "odd rect";
+			convert_rect(ref, expected, src, src_stride, odd_rect);
+			convert_rect(conv, actual, src, src_stride, odd_rect);
+			break;
+		}
+		if (expected != actual) {
+			std::cerr << "FAIL: " << format_name(conv.get_format())
+				<< " " << what << " differs between the " << impl
+				<< " and the C kernels." << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	const char *implementations[] = { "c", "sse2", "ssse3" };
+
+	std::cout << std::left << std::setw(14) << "format"
+		<< std::setw(8) << "kernel"
+		<< std::right << std::setw(14) << "full MP/s"
+		<< std::setw(14) << "tiled MP/s" << std::endl;
+
+	for (auto format : shm_converter_t::get_formats()) {
+		int src_stride = width * detail::shm_format_bpp(static_cast<uint32_t>(format));
+		// NV12 carries the half height chroma plane below the luma
+		int rows = format == shm_format::nv12 ? height + height / 2 : height;
+		std::vector<uint8_t> src(src_stride * rows);
+		for (auto &b : src) {
+			b = rand();
+		}
+		std::vector<uint8_t> dst(width * height * 4);
+		shm_converter_t ref(format, "c");
+
+		for (auto impl : implementations) {
+			std::unique_ptr<shm_converter_t> conv;
+			try {
+				conv.reset(new shm_converter_t(format, impl));
+			} catch (std::invalid_argument &e) {
+				continue;
+			}
+
+			if (!check(*conv, impl, ref, src, src_stride)) {
+				return 1;
+			}
+
+			std::cout << std::left << std::setw(14) << format_name(format)
+				<< std::setw(8) << impl << std::right << std::fixed
+				<< std::setprecision(1)
+				<< std::setw(14) << measure(*conv, dst, src, src_stride, width)
+				<< std::setw(14) << measure(*conv, dst, src, src_stride, tile)
+				<< std::endl;
+		}
+	}
+	return 0;
+}
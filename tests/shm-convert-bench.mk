@@ -0,0 +1,17 @@
+PROJDIR = ../
+
+include $(PROJDIR)defs.mk
+include $(PROJDIR)functions.mk
+include $(PROJDIR)rules.mk
+
+LIBS = wayland-shm++ wayland-server++ wayland-server
+
+SRCS = \
+	   shm-convert-bench.cpp
+
+
+$(eval $(call make_executable,shm-convert-bench,$(SRCS),$(LIBS)))
+
+$(eval $(call print_vars,ALL_TARGETS))
+
+all: $(ALL_TARGETS)
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <wayland-client.hpp>
+#include <wayland-client-shm.hpp>
+
+#include "shm-leak.hpp"
+
+using namespace wayland;
+
+static const int iterations = 200;
+
+// shared memory mappings of this process, client and compositor alike
+static int count_shm_mappings() {
+	std::ifstream maps("/proc/self/maps");
+	std::string line;
+	int count = 0;
+	while(std::getline(maps, line)) {
+		if(line.find("/memfd:wayland-shm") != std::string::npos
+				|| line.find("/dev/shm/wayland-shm") != std::string::npos)
+			count++;
+	}
+	return count;
+}
+
+// pools and buffers created and destroyed by hand, with resizes in between
+static void churn_pools(display_client_t &display, shm_proxy_t &shm) {
+	for(int i = 0; i < iterations; i++) {
+		int32_t size = 64 * 64 * 4;
+		int fd = detail::create_anonymous_file(2 * size);
+		std::vector<buffer_proxy_t> buffers;
+		{
+			shm_pool_proxy_t pool = shm.create_pool(fd, size);
+			buffers.push_back(pool.create_buffer(0, 64, 64, 64 * 4, shm_format::argb8888));
+			pool.resize(2 * size);
+			buffers.push_back(pool.create_buffer(size, 32, 32, 64 * 4, shm_format::xrgb8888));
+		}
+		close(fd);
+
+		// the pool is gone, its buffers keep the mapping alive
+		display.roundtrip();
+		buffers.clear();
+		display.roundtrip();
+	}
+}
+
+// the client side allocator, buffers recycled and pools grown
+static void churn_allocator(display_client_t &display, shm_proxy_t &shm) {
+	for(int i = 0; i < iterations / 10; i++) {
+		shm_buffer_pool_t pool(shm, 64 * 64 * 4);
+		for(int j = 0; j < 10; j++) {
+			int32_t width = 16 * (j + 1);
+			pool.acquire(width, width, width * 4, shm_format::argb8888);
+		}
+		display.roundtrip();
+	}
+	display.roundtrip();
+}
+
+int run_shm_client(int fd) {
+	int baseline = count_shm_mappings();
+	try {
+		display_client_t display(fd);
+		registry_proxy_t registry;
+		shm_proxy_t shm;
+		registry_binder_t binder({ { shm } });
+		if(!binder.bind(display, registry))
+			throw std::runtime_error("Missing global wl_shm.");
+
+		churn_pools(display, shm);
+		churn_allocator(display, shm);
+
+		return count_shm_mappings() - baseline;
+	} catch(std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014, Nils Christopher Brause
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Leak test for the server side SHM pools and buffers.
+ *
+ * A client in the same process creates, resizes and destroys pools
+ * and buffers, both directly and through shm_buffer_pool_t. Once the
+ * client is done, the compositor must have unmapped every pool again.
+ * Run it under valgrind or with an AddressSanitizer build to catch
+ * leaked pool and buffer objects as well, see tests/Makefile.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <wayland-server.hpp>
+#include <wayland-shm.hpp>
+
+#include "shm-leak.hpp"
+
+using namespace wayland;
+
+int main() {
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		std::cerr << "socketpair failed." << std::endl;
+		return 1;
+	}
+
+	display_server_t server("waylandpp-shm-leak-" + std::to_string(getpid()));
+	std::unique_ptr<shm_t> shm(new shm_t(server));
+	if(!wl_client_create(server.c_ptr(), fds[0])) {
+		std::cerr << "wl_client_create failed." << std::endl;
+		return 1;
+	}
+	std::thread compositor([&]() {
+		server.run();
+	});
+
+	int leaked = run_shm_client(fds[1]);
+
+	server.terminate();
+	server.wake_epoll();
+	compositor.join();
+	shm.reset();
+	wl_display_destroy(server.c_ptr());
+
+	if(leaked < 0)
+		return 1;
+	if(leaked) {
+		std::cerr << "FAIL: " << leaked << " SHM mappings left over." << std::endl;
+		return 1;
+	}
+	std::cout << "PASS" << std::endl;
+	return 0;
+}
@@ -0,0 +1,18 @@
+PROJDIR = ../
+
+include $(PROJDIR)defs.mk
+include $(PROJDIR)functions.mk
+include $(PROJDIR)rules.mk
+
+LIBS = wayland-server++ wayland-shm++ wayland-client++ wayland-server wayland-client
+
+SRCS = \
+	   shm-leak.cpp \
+	   shm-leak-client.cpp
+
+
+$(eval $(call make_executable,shm-leak,$(SRCS),$(LIBS)))
+
+$(eval $(call print_vars,ALL_TARGETS))
+
+all: $(ALL_TARGETS)